@@ -0,0 +1,442 @@
+/*
+Benchmark driver for the pegpp examples.
+
+Generates reproducible corpora, runs each example built with bench/probe.h on its corpus
+and reports throughput, allocations, peak RSS and engine counters.
+
+Usage: pegbench [-s size] [-r runs] [-S seed] [-f text|json|csv] [-d dir] [name...]
+
+    -s size     corpus size in bytes, with optional k or m suffix (default 1m)
+    -r runs     runs per benchmark, the fastest is reported (default 3)
+    -S seed     corpus generator seed (default 1)
+    -f format   text table, json lines or csv (default text)
+    -d dir      directory for the corpora, kept after the run (default: a temporary one)
+    name        benchmarks to run (default: all)
+
+Pal without memoization recurses once per remaining input byte, so the pal corpora
+are limited to PALMAX bytes.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const size_t PALMAX = 4096;
+
+// Reproducible random numbers (splitmix64), independent of the standard library
+class rng
+{
+    unsigned long long state;
+
+public:
+
+    rng(unsigned long long seed) : state(seed) { }
+
+    unsigned long long next()
+    {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    unsigned operator()(unsigned n) { return next() % n; }                          // 0 .. n - 1
+    bool chance(unsigned pct) { return (*this)(100) < pct; }
+    template <typename T, size_t N> const T &pick(const T (&a)[N]) { return a[(*this)(N)]; }
+};
+
+// Corpus generators
+
+static const char *words[] = { "alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta", "iota", "kappa" };
+
+static void json_value(rng &r, string &s, unsigned depth)
+{
+    static const char *keys[] = { "id", "name", "tags", "score", "active", "parent", "children", "note" };
+
+    switch ( depth < 4 ? r(8) : 2 + r(6) )
+    {
+        case 0:
+        {
+            s += "{ ";
+            unsigned n = 1 + r(5);
+            for ( unsigned i = 0 ; i < n ; i++ )
+            {
+                s += i ? ", \"" : "\"";
+                s += r.pick(keys);
+                s += "\": ";
+                json_value(r, s, depth + 1);
+            }
+            s += " }";
+            break;
+        }
+
+        case 1:
+        {
+            s += '[';
+            unsigned n = r(6);
+            for ( unsigned i = 0 ; i < n ; i++ )
+            {
+                if ( i )
+                    s += ", ";
+                json_value(r, s, depth + 1);
+            }
+            s += ']';
+            break;
+        }
+
+        case 2:
+        case 3:
+            s += '"';
+            s += r.pick(words);
+            if ( r.chance(20) )
+                s += "\\n\\u00e9\\\"";
+            s += ' ';
+            s += r.pick(words);
+            s += '"';
+            break;
+
+        case 4:
+        case 5:
+            s += to_string(r(100000));
+            if ( r.chance(50) )
+                s += '.' + to_string(r(1000));
+            if ( r.chance(10) )
+                s += "e-" + to_string(r(10));
+            break;
+
+        case 6:
+            s += r.chance(50) ? "true" : "false";
+            break;
+
+        default:
+            s += "null";
+            break;
+    }
+}
+
+static string json_corpus(rng &r, size_t size)
+{
+    string s = "[\n";
+    while ( s.length() < size )
+    {
+        if ( s.length() > 2 )
+            s += ",\n";
+        json_value(r, s, 0);
+    }
+    return s + "\n]\n";
+}
+
+static string varcalc_corpus(rng &r, size_t size)
+{
+    static const char *vars[] = { "a", "b", "c", "rate", "total", "x_1", "y_2" };
+    static const char *ops[] = { " + ", " - ", " * ", " / ", "^" };
+
+    string s;
+    for ( auto v : vars )
+        s += string(v) + " = " + to_string(1 + r(9)) + "\n";
+
+    while ( s.length() < size )
+    {
+        string e;
+        unsigned n = 1 + r(6);
+        for ( unsigned i = 0 ; i < n ; i++ )
+        {
+            if ( i )
+                e += r.pick(ops);
+            if ( r.chance(30) )
+                e += string("(") + r.pick(vars) + " + " + to_string(r(100)) + "." + to_string(r(100)) + ")";
+            else if ( r.chance(50) )
+                e += r.pick(vars);
+            else
+                e += to_string(r(1000)) + (r.chance(20) ? "e-3" : "");
+        }
+
+        switch ( r(4) )
+        {
+            case 0:     s += "print " + e;                  break;
+            case 1:     s += string(r.pick(vars)) + " = " + e;  break;
+            default:    s += e;                             break;
+        }
+
+        s += r.chance(20) ? "   // comment\n" : r.chance(20) ? "; " : "\n";
+    }
+
+    return s + '\n';
+}
+
+static string intcalc_term(rng &r, unsigned depth)
+{
+    string s = to_string(1 + r(99));
+
+    if ( depth < 3 && r.chance(25) )
+        s = "(" + intcalc_term(r, depth + 1) + " + " + intcalc_term(r, depth + 1) + ")";
+    if ( r.chance(30) )
+        s += " * " + to_string(r(9));
+    if ( r.chance(20) )
+        s += " / " + to_string(1 + r(9));
+
+    return s;
+}
+
+static string intcalc_corpus(rng &r, size_t size)
+{
+    string s;
+    while ( s.length() < size )
+    {
+        unsigned n = 1 + r(4);
+        for ( unsigned i = 0 ; i < n ; i++ )
+        {
+            if ( i )
+                s += r.chance(50) ? " + " : " - ";
+            s += intcalc_term(r, 0);
+        }
+        s += '\n';
+    }
+    return s;
+}
+
+static string numsum_corpus(rng &r, size_t size)
+{
+    string s;
+    while ( s.length() < size )
+        if ( r.chance(20) )
+        {
+            unsigned n = 1 + r(4);
+            for ( unsigned i = 0 ; i < n ; i++ )
+                s += (i ? "+" : "") + to_string(r(10000));
+            s += ' ';
+        }
+        else
+        {
+            s += r.pick(words);
+            s += r.chance(10) ? '\n' : ' ';
+        }
+    return s;
+}
+
+static string username_corpus(rng &r, size_t size)
+{
+    string s;
+    while ( s.length() < size )
+    {
+        s += r.chance(5) ? "username" : r.pick(words);
+        s += r.chance(10) ? '\n' : ' ';
+    }
+    return s;
+}
+
+static string pal_corpus(rng &r, size_t size)
+{
+    string s;
+    size = min(size, PALMAX);
+    while ( s.length() < size )
+        s += "abc"[r(3)];
+    return s;
+}
+
+// Benchmarks
+
+struct benchmark
+{
+    string name;
+    string program;
+    vector<string> args;
+    function<string(rng &, size_t)> corpus;
+};
+
+static const vector<benchmark> benchmarks =
+{
+    { "json",       "jsonparser",   { "0" },    json_corpus },
+    { "varcalc",    "varcalc",      { },        varcalc_corpus },
+    { "intcalc",    "intcalc",      { },        intcalc_corpus },
+    { "numsum",     "numsum",       { },        numsum_corpus },
+    { "username",   "username",     { },        username_corpus },
+    { "pal",        "pal",          { },        pal_corpus },
+    { "pal-memo",   "pal",          { "memo" }, pal_corpus },
+};
+
+// Run a program with the given input and collect the probe's report
+static bool run(const string &program, const vector<string> &args, const string &input, const string &stats, map<string, double> &result)
+{
+    pid_t pid = fork();
+    if ( pid < 0 )
+        return false;
+
+    if ( pid == 0 )
+    {
+        int in = open(input.c_str(), O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+        if ( in < 0 || out < 0 )
+            _exit(127);
+        dup2(in, 0);
+        dup2(out, 1);
+        dup2(out, 2);
+
+        vector<char *> argv { const_cast<char *>(program.c_str()) };
+        for ( const auto &a : args )
+            argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+
+        setenv("PEGBENCH_STATS", stats.c_str(), 1);
+        execv(program.c_str(), argv.data());
+        _exit(127);
+    }
+
+    int status;
+    if ( waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) == 127 )
+        return false;
+
+    ifstream f(stats);
+    string key;
+    double value;
+    result.clear();
+    while ( f >> key >> value )
+        result[key] = value;
+    unlink(stats.c_str());
+
+    return result.count("seconds");
+}
+
+static size_t parse_size(const char *s)
+{
+    char *end;
+    size_t n = strtoull(s, &end, 10);
+    if ( *end == 'k' || *end == 'K' )
+        n <<= 10;
+    else if ( *end == 'm' || *end == 'M' )
+        n <<= 20;
+    return n;
+}
+
+static void usage()
+{
+    cerr << "usage: pegbench [-s size] [-r runs] [-S seed] [-f text|json|csv] [-d dir] [name...]\n";
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = 1 << 20;
+    unsigned runs = 3;
+    unsigned long long seed = 1;
+    string format = "text";
+    string dir;
+    vector<string> names;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "s:r:S:f:d:")) != -1 )
+        switch ( opt )
+        {
+            case 's':   size = parse_size(optarg);      break;
+            case 'r':   runs = max(1, atoi(optarg));    break;
+            case 'S':   seed = strtoull(optarg, nullptr, 10); break;
+            case 'f':   format = optarg;                break;
+            case 'd':   dir = optarg;                   break;
+            default:    usage();
+        }
+    for ( int i = optind ; i < argc ; i++ )
+        names.push_back(argv[i]);
+
+    if ( format != "text" && format != "json" && format != "csv" )
+        usage();
+
+    // Programs are looked up next to this one
+    string bindir = argv[0];
+    bindir = bindir.find('/') == string::npos ? "." : bindir.substr(0, bindir.rfind('/'));
+
+    bool keep = !dir.empty();
+    if ( keep )
+        mkdir(dir.c_str(), 0777);
+    else
+    {
+        char tmpl[] = "/tmp/pegbench.XXXXXX";
+        if ( !mkdtemp(tmpl) )
+        {
+            perror("mkdtemp");
+            return 1;
+        }
+        dir = tmpl;
+    }
+
+    if ( format == "text" )
+        printf("%-10s %10s %10s %10s %12s %10s %12s %12s %12s\n",
+                "name", "bytes", "MB/s", "ns/byte", "allocs", "rss_kb", "bytes_read", "backtracks", "memo_peak");
+    else if ( format == "csv" )
+        printf("name,bytes,seconds,mb_per_s,ns_per_byte,allocs,alloc_bytes,peak_rss_kb,bytes_read,rules,backtracks,memo_entries,memo_peak\n");
+
+    int failures = 0;
+
+    for ( const auto &b : benchmarks )
+    {
+        if ( !names.empty() && find(names.begin(), names.end(), b.name) == names.end() )
+            continue;
+
+        rng r(seed);
+        string corpus = b.corpus(r, size);
+        string input = dir + "/" + b.name + ".txt";
+        ofstream(input, ios::binary) << corpus;
+
+        map<string, double> best, result;
+        for ( unsigned i = 0 ; i < runs ; i++ )
+        {
+            if ( !run(bindir + "/" + b.program, b.args, input, dir + "/stats", result) )
+            {
+                best.clear();
+                break;
+            }
+            if ( best.empty() || result["seconds"] < best["seconds"] )
+                best = result;
+        }
+
+        if ( !keep )
+            unlink(input.c_str());
+
+        if ( best.empty() )
+        {
+            cerr << b.name << ": failed to run " << bindir << "/" << b.program << endl;
+            failures++;
+            continue;
+        }
+
+        double bytes = corpus.length();
+        double seconds = best["seconds"];
+        double mbps = bytes / seconds / 1e6;
+        double nspb = seconds * 1e9 / bytes;
+
+        if ( format == "text" )
+            printf("%-10s %10.0f %10.2f %10.1f %12.0f %10.0f %12.0f %12.0f %12.0f\n",
+                    b.name.c_str(), bytes, mbps, nspb, best["allocs"], best["peak_rss_kb"],
+                    best["bytes_read"], best["backtracks"], best["memo_peak"]);
+        else if ( format == "csv" )
+            printf("%s,%.0f,%.9f,%.3f,%.3f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f\n",
+                    b.name.c_str(), bytes, seconds, mbps, nspb, best["allocs"], best["alloc_bytes"], best["peak_rss_kb"],
+                    best["bytes_read"], best["rules"], best["backtracks"], best["memo_entries"], best["memo_peak"]);
+        else
+            printf("{\"name\": \"%s\", \"bytes\": %.0f, \"seconds\": %.9f, \"mb_per_s\": %.3f, \"ns_per_byte\": %.3f, "
+                   "\"allocs\": %.0f, \"alloc_bytes\": %.0f, \"peak_rss_kb\": %.0f, \"bytes_read\": %.0f, \"rules\": %.0f, "
+                   "\"backtracks\": %.0f, \"memo_entries\": %.0f, \"memo_peak\": %.0f}\n",
+                    b.name.c_str(), bytes, seconds, mbps, nspb, best["allocs"], best["alloc_bytes"], best["peak_rss_kb"],
+                    best["bytes_read"], best["rules"], best["backtracks"], best["memo_entries"], best["memo_peak"]);
+        fflush(stdout);
+    }
+
+    if ( !keep )
+        rmdir(dir.c_str());
+
+    return failures ? 1 : 0;
+}
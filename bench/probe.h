@@ -0,0 +1,77 @@
+#ifndef PEGBENCH_PROBE_H_INCLUDED
+#define PEGBENCH_PROBE_H_INCLUDED
+
+// Benchmark probe, force-included (-include bench/probe.h) in the programs run by pegbench.
+// It counts heap allocations, enables the engine counters of peg.h and, at exit, writes
+// both together with the elapsed time and peak RSS to the file named by PEGBENCH_STATS.
+
+#define PEG_STATS
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <chrono>
+#include <sys/resource.h>
+
+#include "peg.h"
+
+namespace pegbench
+{
+    inline unsigned long long allocs, alloc_bytes;
+
+    // Starts the clock before main() and reports when static objects are destroyed
+    class probe
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    public:
+
+        ~probe()
+        {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            const char *path = std::getenv("PEGBENCH_STATS");
+            if ( !path )
+                return;
+
+            FILE *f = std::fopen(path, "w");
+            if ( !f )
+                return;
+
+            struct rusage ru;
+            getrusage(RUSAGE_SELF, &ru);
+
+            std::fprintf(f, "seconds %.9f\n", seconds);
+            std::fprintf(f, "allocs %llu\n", allocs);
+            std::fprintf(f, "alloc_bytes %llu\n", alloc_bytes);
+            std::fprintf(f, "peak_rss_kb %ld\n", ru.ru_maxrss);
+            std::fprintf(f, "bytes_read %llu\n", peg::stats.bytes);
+            std::fprintf(f, "rules %llu\n", peg::stats.rules);
+            std::fprintf(f, "backtracks %llu\n", peg::stats.backtracks);
+            std::fprintf(f, "memo_entries %llu\n", peg::stats.memo);
+            std::fprintf(f, "memo_peak %llu\n", peg::stats.memo_peak);
+            std::fclose(f);
+        }
+    };
+
+    // Force-included first, so constructed first and destroyed last
+    inline probe the_probe;
+
+    inline void *allocate(std::size_t n)
+    {
+        allocs++;
+        alloc_bytes += n;
+        if ( void *p = std::malloc(n ? n : 1) )
+            return p;
+        throw std::bad_alloc();
+    }
+}
+
+void *operator new(std::size_t n) { return pegbench::allocate(n); }
+void *operator new[](std::size_t n) { return pegbench::allocate(n); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+#endif
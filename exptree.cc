@@ -0,0 +1,100 @@
+/*
+The expressions of intcalc.cc, printed fully parenthesized from their syntax trees
+*/
+
+#include <iostream>
+#include <string>
+#include <cstring>
+
+#define PEG_TREE
+
+#include "peg.h"
+
+using namespace std;
+using namespace peg;
+
+class exptree : public Parser<>
+{
+    Rule WS, SIGN, DIGIT, NUMBER, LPAR, RPAR, ADD, SUB, MUL, DIV;
+    Rule calc, expression, term, factor;
+
+    // Print the operands of an expression or term, grouping them from the left
+    void print_operations(Tree::Cursor c)
+    {
+        Tree::Cursor op = c.child();
+        for ( unsigned i = 1 ; i < c.children() ; i += 2 )
+            cout << '(';
+        print(op);
+        while ( op.next() )
+        {
+            cout << ' ' << op.text()[0] << ' ';
+            print(op.next());
+            cout << ')';
+        }
+    }
+
+public:
+
+    exptree(istream &in = cin) : Parser(calc, in)
+    {
+        limit_depth(10000);
+        build_tree();
+
+        // Lexical rules
+        WS          = *" \t\f\r\n"_ccl;
+        SIGN        = "+-"_ccl;
+        DIGIT       = "0-9"_ccl;
+        NUMBER      = ~SIGN >> +DIGIT;
+        LPAR        = '(' >> WS;
+        RPAR        = ')' >> WS;
+        ADD         = '+' >> WS;
+        SUB         = '-' >> WS;
+        MUL         = '*' >> WS;
+        DIV         = '/' >> WS;
+
+        // Expressions
+        calc        = WS >> expression;
+        expression  = term >> *( (ADD | SUB) >> term );
+        term        = factor >> *( (MUL | DIV) >> factor );
+        factor      = NUMBER >> WS
+                    | LPAR >> expression >> RPAR
+                    ;
+
+        // Named rules make the nodes of the tree
+        peg_debug(expression);
+        peg_debug(term);
+        peg_debug(NUMBER);
+        peg_debug(ADD);
+        peg_debug(SUB);
+        peg_debug(MUL);
+        peg_debug(DIV);
+    }
+
+    // Print the expression, term or number at c
+    void print(Tree::Cursor c)
+    {
+        if ( !strcmp(c.kind(), "NUMBER") )
+            cout << c.text();
+        else if ( c.children() == 1 )
+            print(c.child());
+        else
+            print_operations(c);
+    }
+
+    void print()
+    {
+        print(tree().top());
+        cout << endl;
+    }
+};
+
+int main()
+{
+    exptree et;
+
+    while ( et.parse() )
+    {
+        et.print();
+        et.accept();
+    }
+}
@@ -19,6 +19,9 @@ public:
 
     intcalc(istream &in = cin ) : Parser(calc, in)
     {
+        // Fail on more than about 3000 nested parentheses instead of overflowing the stack
+        limit_depth(10000);
+
         // Lexical rules
         WS          = *" \t\f\r\n"_ccl;
         SIGN        = "+-"_ccl;
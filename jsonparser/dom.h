@@ -0,0 +1,382 @@
+#ifndef JSON_DOM_H_INCLUDED
+#define JSON_DOM_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <functional>
+
+#include "handler.h"
+
+namespace json
+{
+    // The memory of a document. Values, arrays, objects and strings are carved out of
+    // blocks that double in size, and are all released together: there are no per-value
+    // destructors or frees.
+    class arena
+    {
+        static const std::size_t BLOCKSIZE = 4096;
+
+        struct block
+        {
+            block *next;
+            std::size_t size;
+        };
+
+        block *head = nullptr;
+        char *ptr = nullptr, *end = nullptr;
+
+        void grow(std::size_t n)
+        {
+            std::size_t size = head ? head->size * 2 : BLOCKSIZE;
+            while ( size < n + sizeof(block) )
+                size *= 2;
+
+            block *b = static_cast<block *>(::operator new(size));
+            b->next = head;
+            b->size = size;
+            head = b;
+            ptr = reinterpret_cast<char *>(b + 1);
+            end = reinterpret_cast<char *>(b) + size;
+        }
+
+    public:
+
+        arena() = default;
+        arena(const arena &) = delete;
+        arena(arena &&a) noexcept : head(a.head), ptr(a.ptr), end(a.end) { a.head = nullptr; a.ptr = a.end = nullptr; }
+        ~arena() { release(); }
+
+        arena &operator=(arena &&a) noexcept
+        {
+            std::swap(head, a.head);
+            std::swap(ptr, a.ptr);
+            std::swap(end, a.end);
+            return *this;
+        }
+
+        void *allocate(std::size_t n, std::size_t align)
+        {
+            std::size_t pad = -reinterpret_cast<std::uintptr_t>(ptr) & (align - 1);
+            if ( std::size_t(end - ptr) < pad + n )
+            {
+                grow(n + align);
+                pad = -reinterpret_cast<std::uintptr_t>(ptr) & (align - 1);
+            }
+            void *p = ptr + pad;
+            ptr += pad + n;
+            return p;
+        }
+
+        template <typename T> T *allocate(std::size_t n) { return static_cast<T *>(allocate(n * sizeof(T), alignof(T))); }
+
+        // Free everything
+        void release()
+        {
+            while ( head )
+            {
+                block *b = head;
+                head = head->next;
+                ::operator delete(b);
+            }
+            ptr = end = nullptr;
+        }
+
+        // Free everything but the largest block, to be reused
+        void clear()
+        {
+            if ( !head )
+                return;
+            block *b = head->next;
+            head->next = nullptr;
+            ptr = reinterpret_cast<char *>(head + 1);
+            while ( b )
+            {
+                block *n = b->next;
+                ::operator delete(b);
+                b = n;
+            }
+        }
+    };
+
+    // An object key: its text and, if it is interned, its id in a key table
+    struct key_type
+    {
+        static const std::uint32_t NONE = ~std::uint32_t(0);
+
+        std::string_view text;
+        std::uint32_t id = NONE;
+
+        operator std::string_view() const { return text; }
+    };
+
+    // Interned object keys: each distinct key is stored once, with an id, and all the
+    // objects of all the documents built with the table share its text. Keys that are
+    // too long, or that come when the table is full, are not interned.
+    class key_table
+    {
+        static const std::size_t MAXKEYS = 1 << 16;
+        static const std::size_t MAXLEN = 128;
+
+        arena mem;
+        std::unordered_map<std::string_view, std::uint32_t> ids;
+        std::vector<std::string_view> texts;
+
+    public:
+
+        // The interned key s, or s without id
+        key_type intern(std::string_view s)
+        {
+            auto iter = ids.find(s);
+            if ( iter != ids.end() )
+                return { iter->first, iter->second };
+            if ( texts.size() >= MAXKEYS || s.length() > MAXLEN )
+                return { s };
+
+            char *p = mem.allocate<char>(s.length());
+            std::copy(s.begin(), s.end(), p);
+            key_type k { { p, s.length() }, std::uint32_t(texts.size()) };
+            ids.emplace(k.text, k.id);
+            texts.push_back(k.text);
+            return k;
+        }
+
+        std::size_t size() const { return texts.size(); }
+        std::string_view text(std::uint32_t id) const { return texts[id]; }
+    };
+
+    class value;
+    using member = std::pair<key_type, value>;
+
+    // A contiguous run of array elements or object members
+    template <typename T>
+    class view
+    {
+        const T *ptr;
+        std::size_t len;
+
+    public:
+
+        view(const T *p, std::size_t n) : ptr(p), len(n) { }
+
+        std::size_t size() const { return len; }
+        const T &operator[](std::size_t idx) const { return ptr[idx]; }
+        const T *begin() const { return ptr; }
+        const T *end() const { return ptr + len; }
+    };
+
+    // A JSON value in an arena. Values are trivially copyable and destructible: strings,
+    // arrays and objects point into the arena, so moving a value into its parent copies
+    // a few words. Objects are runs of members in document order; objects of more than
+    // SMALL members are followed by a hashed index of their keys.
+    class value
+    {
+    public:
+
+        enum kind_type : unsigned char { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+        static const std::size_t SMALL = 8;
+
+        // Slots of the index of an object of n members
+        static std::size_t index_size(std::size_t n) 
+        { 
+            std::size_t size = 16;
+            while ( size < 2 * n )
+                size *= 2;
+            return size;
+        }
+
+    private:
+
+        kind_type k = NUL;
+        std::size_t len = 0;
+        union
+        {
+            bool b;
+            double d;
+            const char *s;
+            const value *a;
+            const member *o;
+        };
+
+    public:
+
+        value() : d(0) { }
+
+        static value boolean(bool b) { value v; v.k = BOOL; v.b = b; return v; }
+        static value number(double d) { value v; v.k = NUMBER; v.d = d; return v; }
+        static value string(std::string_view s) { value v; v.k = STRING; v.s = s.data(); v.len = s.length(); return v; }
+        static value array(const value *a, std::size_t n) { value v; v.k = ARRAY; v.a = a; v.len = n; return v; }
+        static value object(const member *o, std::size_t n) { value v; v.k = OBJECT; v.o = o; v.len = n; return v; }
+
+        kind_type kind() const { return k; }
+
+        bool as_bool() const { return b; }
+        double as_number() const { return d; }
+        std::string_view as_string() const { return { s, len }; }
+        view<value> as_array() const { return { a, len }; }
+        view<member> as_object() const { return { o, len }; }
+
+        // Object member lookup, or null: linear in small objects, hashed in large ones
+        const value *find(std::string_view key) const
+        {
+            if ( len <= SMALL )
+            {
+                for ( const auto &m : as_object() )
+                    if ( m.first.text == key )
+                        return &m.second;
+                return nullptr;
+            }
+
+            const std::uint32_t *index = reinterpret_cast<const std::uint32_t *>(o + len);
+            std::size_t mask = index_size(len) - 1;
+            for ( std::size_t h = std::hash<std::string_view>()(key) & mask ; index[h] ; h = (h + 1) & mask )
+                if ( o[index[h] - 1].first.text == key )
+                    return &o[index[h] - 1].second;
+            return nullptr;
+        }
+
+        // Lookup by interned key, comparing ids in small objects
+        const value *find(const key_type &key) const
+        {
+            if ( key.id == key_type::NONE || len > SMALL )
+                return find(key.text);
+            for ( const auto &m : as_object() )
+                if ( m.first.id == key.id )
+                    return &m.second;
+            return nullptr;
+        }
+    };
+
+    // A parsed document, owning the arena of its values and sharing its key table
+    class document
+    {
+        arena mem;
+        value top;
+        std::shared_ptr<const key_table> table;
+
+        friend class document_builder;
+
+    public:
+
+        const value &root() const { return top; }
+        const key_table *keys() const { return table.get(); }
+
+        // Drop the values, keeping memory for the next document
+        void clear()
+        {
+            mem.clear();
+            top = value();
+        }
+    };
+
+    // A handler building a document in one pass. Finished values wait on a stack until
+    // their container ends, and then move together into a contiguous run in the arena.
+    // The document and the stacks keep their memory from one document to the next, and
+    // keys are interned in a table kept across documents unless told otherwise.
+    class document_builder : public handler
+    {
+        document doc;
+        std::shared_ptr<key_table> table;
+        std::vector<value> values;                  // finished values
+        std::vector<key_type> keys;                 // keys of open objects
+        std::vector<std::pair<std::size_t, std::size_t>> open;     // where open containers start in values and keys
+
+        std::string_view copy(std::string_view s)
+        {
+            char *p = doc.mem.allocate<char>(s.length());
+            std::copy(s.begin(), s.end(), p);
+            return { p, s.length() };
+        }
+
+    public:
+
+        document_builder(bool intern = true) : table(intern ? std::make_shared<key_table>() : nullptr) { }
+
+        // The last document built
+        const document &get() const { return doc; }
+        document take() { return std::move(doc); }
+
+        // The key table, or null
+        key_table *key_ids() { return table.get(); }
+
+        void start_document()
+        {
+            doc.clear();
+            doc.table = table;
+            values.clear();
+            keys.clear();
+            open.clear();
+        }
+
+        void end_document()
+        {
+            doc.top = values.back();
+            values.pop_back();
+        }
+
+        void null() { values.emplace_back(); }
+        void boolean(bool b) { values.push_back(value::boolean(b)); }
+        void number(double d) { values.push_back(value::number(d)); }
+        void string(std::string_view s) { values.push_back(value::string(copy(s))); }
+        void key(std::string_view s) 
+        { 
+            key_type k = table ? table->intern(s) : key_type{ s };
+            if ( k.id == key_type::NONE )
+                k.text = copy(s);
+            keys.push_back(k); 
+        }
+
+        void start_array() { open.emplace_back(values.size(), keys.size()); }
+        void end_array()
+        {
+            std::size_t first = open.back().first, n = values.size() - first;
+            open.pop_back();
+
+            value *a = doc.mem.allocate<value>(n);
+            std::uninitialized_copy(values.begin() + first, values.end(), a);
+            values.resize(first);
+            values.push_back(value::array(a, n));
+        }
+
+        void start_object() { open.emplace_back(values.size(), keys.size()); }
+        void end_object()
+        {
+            auto [first, kfirst] = open.back();
+            std::size_t n = values.size() - first;
+            open.pop_back();
+
+            std::size_t slots = n > value::SMALL ? value::index_size(n) : 0;
+            member *o = static_cast<member *>(doc.mem.allocate(n * sizeof(member) + slots * sizeof(std::uint32_t), alignof(member)));
+            for ( std::size_t i = 0 ; i < n ; i++ )
+                new (o + i) member(keys[kfirst + i], values[first + i]);
+
+            // Index members by key, 1-based, first ones first
+            if ( slots )
+            {
+                std::uint32_t *index = reinterpret_cast<std::uint32_t *>(o + n);
+                std::fill(index, index + slots, 0);
+                for ( std::size_t i = 0 ; i < n ; i++ )
+                {
+                    std::size_t h = std::hash<std::string_view>()(o[i].first.text) & (slots - 1);
+                    while ( index[h] )
+                        h = (h + 1) & (slots - 1);
+                    index[h] = i + 1;
+                }
+            }
+
+            values.resize(first);
+            keys.resize(kfirst);
+            values.push_back(value::object(o, n));
+        }
+    };
+
+} // namespace json
+
+#endif
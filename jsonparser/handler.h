@@ -0,0 +1,37 @@
+#ifndef JSON_HANDLER_H_INCLUDED
+#define JSON_HANDLER_H_INCLUDED
+
+#include <cstdint>
+#include <string_view>
+
+namespace json
+{
+    // Receives the values of JSON documents as they are parsed, in document order.
+    // Strings and keys are unescaped, and only valid during the call.
+    class handler
+    {
+    public:
+
+        virtual ~handler() = default;
+
+        virtual void start_document() { }
+        virtual void end_document() { }
+        virtual void pointer(std::string_view p) { }    // in lazy mode, the JSON Pointer of the next document
+
+        virtual void null() = 0;
+        virtual void boolean(bool b) = 0;
+        virtual void number(double d) = 0;
+        virtual void integer(std::int64_t i) { number(double(i)); }     // numbers without fraction or exponent, of up to 18 digits
+        virtual void string(std::string_view s) = 0;
+
+        virtual void start_array() = 0;
+        virtual void end_array() = 0;
+
+        virtual void start_object() = 0;
+        virtual void key(std::string_view s) = 0;       // before each member's value
+        virtual void end_object() = 0;
+    };
+
+} // namespace json
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef JSON_INDEX_H_INCLUDED
+#define JSON_INDEX_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace json
+{
+    // Finds the structural characters of JSON text, 64 bytes at a time with SSE2 where
+    // available: quotes, and brackets, commas and colons out of strings. Text can be
+    // scanned in consecutive pieces.
+    class structural_index
+    {
+        std::uint64_t escape = 0;       // the next piece starts with an escaped char
+        std::uint64_t inside = 0;       // all ones if it starts in a string
+
+        struct masks { std::uint64_t quote, backslash, structural; };
+
+        // One bit per byte of 64
+        static masks classify(const char *p)
+        {
+            masks m { 0, 0, 0 };
+#ifdef __SSE2__
+            for ( unsigned i = 0 ; i < 4 ; i++ )
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+                __m128i b = _mm_or_si128(v, _mm_set1_epi8(0x20));      // [ ] to { }
+                auto eq = [ ](__m128i x, char c) { return std::uint64_t(unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(c))))); };
+
+                m.quote |= eq(v, '"') << 16 * i;
+                m.backslash |= eq(v, '\\') << 16 * i;
+                m.structural |= (eq(b, '{') | eq(b, '}') | eq(v, ',') | eq(v, ':')) << 16 * i;
+            }
+#else
+            for ( unsigned i = 0 ; i < 64 ; i++ )
+            {
+                std::uint64_t bit = std::uint64_t(1) << i;
+                switch ( p[i] )
+                {
+                    case '"':   m.quote |= bit;         break;
+                    case '\\':  m.backslash |= bit;     break;
+                    case '[':
+                    case ']':
+                    case '{':
+                    case '}':
+                    case ',':
+                    case ':':   m.structural |= bit;    break;
+                }
+            }
+#endif
+            return m;
+        }
+
+        // Chars escaped by a backslash
+        std::uint64_t escaped(std::uint64_t bs)
+        {
+            std::uint64_t esc = escape;
+            escape = 0;
+            bs &= ~esc;
+            while ( bs )
+            {
+                unsigned i = __builtin_ctzll(bs);
+                if ( i == 63 )
+                {
+                    escape = 1;
+                    break;
+                }
+                esc |= std::uint64_t(2) << i;
+                bs &= ~((std::uint64_t(4) << i) - 1);
+            }
+            return esc;
+        }
+
+        // Bit i is the parity of bits 0 to i
+        static std::uint64_t prefix_xor(std::uint64_t x)
+        {
+            for ( unsigned s = 1 ; s < 64 ; s *= 2 )
+                x ^= x << s;
+            return x;
+        }
+
+    public:
+
+        // The text scanned ends in a string
+        bool in_string() const { return inside; }
+
+        // Append the positions of the structural chars of p[0, n) to idx, base being
+        // the position of p
+        void scan(const char *p, std::size_t n, std::size_t base, std::vector<std::size_t> &idx)
+        {
+            for ( std::size_t i = 0 ; i < n ; i += 64 )
+            {
+                char tail[64];
+                const char *q = p + i;
+                if ( n - i < 64 )
+                {
+                    std::memset(tail, ' ', sizeof tail);
+                    std::memcpy(tail, q, n - i);
+                    q = tail;
+                }
+
+                masks m = classify(q);
+                std::uint64_t quotes = m.quote & ~escaped(m.backslash);
+                std::uint64_t str = prefix_xor(quotes) ^ inside;       // opening quotes and string bodies
+                inside = std::uint64_t(std::int64_t(str) >> 63);
+
+                for ( std::uint64_t bits = (m.structural & ~str) | quotes ; bits ; bits &= bits - 1 )
+                    idx.push_back(base + i + __builtin_ctzll(bits));
+            }
+        }
+    };
+
+    // Find the elements of a top-level array. seps gets the positions of its opening
+    // bracket, of the commas between its elements and of its closing bracket. False if
+    // the text is not one array with balanced brackets and strings, between white space.
+    inline bool array_elements(std::string_view s, std::vector<std::size_t> &seps)
+    {
+        static const std::size_t BLOCK = 1 << 16;
+
+        structural_index si;
+        std::vector<std::size_t> idx;
+        long depth = 0;
+        bool closed = false;
+
+        seps.clear();
+        for ( std::size_t b = 0 ; b < s.length() ; b += BLOCK )
+        {
+            idx.clear();
+            si.scan(s.data() + b, std::min(BLOCK, s.length() - b), b, idx);
+
+            for ( auto p : idx )
+            {
+                if ( closed )
+                    return false;
+                switch ( char c = s[p] )
+                {
+                    case '[':
+                    case '{':
+                        if ( !depth && c != '[' )
+                            return false;
+                        if ( !depth++ )
+                            seps.push_back(p);
+                        break;
+                    case ']':
+                    case '}':
+                        if ( --depth < 0 )
+                            return false;
+                        if ( !depth )
+                        {
+                            seps.push_back(p);
+                            closed = true;
+                        }
+                        break;
+                    case ',':
+                        if ( depth == 1 )
+                            seps.push_back(p);
+                        break;
+                    default:
+                        if ( !depth )
+                            return false;
+                        break;
+                }
+            }
+        }
+
+        auto ws = [&](std::size_t b, std::size_t e)
+        {
+            for ( ; b < e ; b++ )
+                if ( !std::strchr(" \t\r\n", s[b]) || !s[b] )
+                    return false;
+            return true;
+        };
+        return closed && !si.in_string() && ws(0, seps.front()) && ws(seps.back() + 1, s.length());
+    }
+
+} // namespace json
+
+#endif
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <optional>
+
+#include "parser.h"
+
+using namespace std;
+using namespace json;
+
+// Orders read as NDJSON records, e.g.
+//
+//  { "id": 1, "customer": "ann", "items": [ { "sku": "a1", "quantity": 2, "price": 9.5 } ], "paid": true, "coupon": null }
+
+struct item
+{
+    string sku;
+    int quantity = 0;
+    double price = 0;
+};
+
+struct order
+{
+    long long id = 0;
+    string customer;
+    vector<item> items;
+    vector<string> tags;
+    optional<string> coupon;
+    bool paid = false;
+};
+
+static const object_schema<item> item_schema
+{
+    { "sku", &item::sku },
+    { "quantity", &item::quantity },
+    { "price", &item::price }
+};
+
+static const object_schema<order> order_schema
+{
+    { "id", &order::id },
+    { "customer", &order::customer },
+    { "items", &order::items, item_schema },
+    { "tags", &order::tags },
+    { "coupon", &order::coupon },
+    { "paid", &order::paid }
+};
+
+// Adds up each order as it is bound
+class totals : public binder
+{
+public:
+
+    order o;
+    unsigned long long orders = 0, items = 0, coupons = 0;
+    double revenue = 0;
+
+    totals() : binder(order_schema, &o) { }
+
+    void end_document()
+    {
+        orders++;
+        coupons += o.coupon.has_value();
+        for ( const auto &i : o.items )
+        {
+            items += i.quantity;
+            if ( o.paid )
+                revenue += i.quantity * i.price;
+        }
+    }
+};
+
+int main()
+{
+    totals t;
+    JsonParser jp(t, true);
+
+    while ( !jp.done() && jp.parse() )
+        jp.accept();
+    if ( !jp.done() )
+        cerr << jp.get_error() << endl;
+
+    cout << t.orders << " orders, " << t.items << " items, " << t.coupons << " coupons, revenue " << t.revenue << endl;
+}
@@ -1,160 +1,222 @@
 #include <iostream>
 #include <string>
-#include <locale> 
-#include <codecvt> 
-#include <math.h>
+#include <vector>
+#include <thread>
+#include <atomic>
 
 #include "peg.h"
-#include "json.h"
+#include "parser.h"
+#include "writer.h"
+#include "index.h"
 
 using namespace std;
 using namespace peg;
 using namespace json;
 
-class JsonParser : public Parser<json_type>
+// Builds each document and then prints it
+class printer : public document_builder
 {
-    static string get_utf8(const string &source) 
-    {
-        static wstring_convert<codecvt_utf8_utf16<char16_t>, char16_t> convert;
-        
-        u16string s16;
+    writer &out;
 
-        for ( unsigned i = 0 ; i < source.length() ; )
-        {
-            unsigned char c = source[i++];
+public:
 
-            if ( c != '\\' )
-            {
-                s16 += c;
-                continue;
-            }
+    printer(writer &w) : out(w) { }
 
-            switch ( c = source[i++] )
-            {
-                case '"': 
-                case '\\':
-                case '/':   s16 += c;      break;
-
-                case 'b':   s16 += '\b';   break;
-                case 'f':   s16 += '\f';   break;
-                case 'n':   s16 += '\n';   break;
-                case 'r':   s16 += '\r';   break;
-                case 't':   s16 += '\t';   break;
-
-                case 'u':   s16 += stoi(source.substr(i, 4), nullptr, 16);
-                            i += 4;
-                            break;
-            }
-        } 
-
-        return convert.to_bytes(s16); 
-    } 
- 
-    Rule    Eof{"Eof"}, WS, LBracket{"LBracket"}, RBracket{"RBracket"}, 
-            LBrace{"LBrace"}, RBrace{"RBrace"}, Colon{"Colon"}, Comma{"Comma"}, 
-            Boolean{"Boolean"}, Null{"Null"}, 
-            Number{"Number"}, Sign, Whole, Fraction, Exponent, 
-            String{"String"}, Char, PlainChar, EscapedChar, UTF16,
-            Json, Value, Object, Array;
+    void end_document()
+    {
+        document_builder::end_document();
+        out.write(get().root());
+    }
+};
 
+// Prints extracted values, each after the JSON Pointer that led to it
+class extract_printer : public writer
+{
 public:
 
-    JsonParser(size_t tabsize, istream &in = cin) : Parser(Json, in)	
+    using writer::writer;
+
+    void pointer(string_view p)
     {
-        // Tokens
-
-        Eof         =   !Any();
-        WS          =   *" \t\r\n"_ccl;
-
-        LBracket    =   '[' >> WS;
-        RBracket    =   ']' >> WS;
-        LBrace      =   '{' >> WS;
-        RBrace      =   '}' >> WS;
-        Colon       =   ':' >> WS;
-        Comma       =   ',' >> WS;
-
-        Null        =   "null" >> WS                        do_( val(0) = nullptr; )
-                    ;
-
-        Boolean     =   "true" >> WS                        do_( val(0) = true; )
-                    |   "false" >> WS                       do_( val(0) = false; )
-                    ;
-
-        Number      =   ( ~Sign >> Whole >> ~Fraction >> ~Exponent )-- >> WS
-                                                            do_( val(0) = stod(text()); )
-                    ;
-        Sign        =   '-';
-        Whole       =   '0' 
-                    |   "1-9"_ccl >> *"0-9"_ccl
-                    ;
-        Fraction    =   '.' >> +"0-9"_ccl;
-        Exponent    =   "eE"_ccl >> ~"+-"_ccl >> +"0-9"_ccl;
-
-        String      =   '"' >> ( *Char )-- >> '"' >> WS     do_( val(0) = get_utf8(text()); )
-                    ;
-        Char        =   PlainChar 
-                    |   EscapedChar 
-                    |   UTF16
-                    ;
-        PlainChar   =   "^\x00-\x1F\"\\"_ccl;
-        EscapedChar =   '\\' >> "\"\\/bfnrt"_ccl;
-        UTF16       =   "\\u" >> "0-9a-fA-F"_ccl[4];
-
-        // Grammar
-
-        Json        =   WS >> Value >> Eof                  do_( cout << json_formatter(tabsize).format(val(1)) << endl; )
-                    ;
-
-        Value       =   Object
-                    |   Array
-                    |   String
-                    |   Number
-                    |   Boolean
-                    |   Null
-                    ;
-
-        Array       =   LBracket                            do_( val(0) = array_type(); )
-                        >> ~
-                        (
-                            Value                           do_( val<array_type>(0).push_back(val(1)); )
-                            >> *
-                            (
-                                Comma >> Value              do_( val<array_type>(0).push_back(val(3)); )
-                            )
-                        )   
-                        >> RBracket
-                    ;
-
-        Object      =   LBrace                              do_( val(0) = object_type(); )
-                        >> ~
-                        (
-                            String >> Colon >> Value        do_( val<object_type>(0)[val<string_type>(1)] = val(3); )
-                            >> *
-                            (
-                                Comma >> String >> Colon >> Value   
-                                                            do_( val<object_type>(0)[val<string_type>(5)] = val(7); )
-                            )
-                        )
-                        >> RBrace
-                    ;
+        text(p);
+        text(": ");
     }
 };
 
+// Reads text in memory
+class membuf : public streambuf
+{
+public:
+
+    membuf(const char *p, size_t n) 
+    { 
+        char *b = const_cast<char *>(p);
+        setg(b, b, b + n); 
+    }
+};
+
+// Prints a top-level array like a writer, parsing its elements with threads. A SIMD 
+// pass finds the elements, which are parsed in tasks of about TASKLEN bytes by parsers
+// of their own on the shared grammar. The output of the tasks is written in order when 
+// all are done. False if the input is not a valid array, and nothing is written.
+static bool print_parallel(const string &input, unsigned tabsize, unsigned threads)
+{
+    static const size_t TASKLEN = 1 << 20;
+
+    vector<size_t> seps;
+    if ( !array_elements(input, seps) )
+        return false;
+
+    // Tasks of consecutive elements: element i goes from seps[i] + 1 to seps[i + 1]
+    vector<size_t> tasks;
+    size_t n = seps.size() - 1;
+    for ( size_t i = 0 ; i < n ; )
+    {
+        tasks.push_back(i);
+        size_t start = seps[i];
+        do
+            i++;
+        while ( i < n && seps[i] - start < TASKLEN );
+    }
+    tasks.push_back(n);
+
+    // Each task writes "[ e1, e2" and its [ is replaced by a comma after the first one
+    vector<string> out(tasks.size() - 1);
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+
+    auto work = [&]
+    {
+        for ( size_t t ; !failed && (t = next++) < out.size() ; )
+        {
+            size_t b = seps[tasks[t]] + 1, e = seps[tasks[t + 1]];
+            membuf mb(input.data() + b, e - b);
+            istream in(&mb);
+
+            writer w(out[t], tabsize);
+            w.start_array();
+            JsonParser jp(w, JsonParser::ELEMENTS, in);
+            for ( size_t i = tasks[t] ; i < tasks[t + 1] ; i++ )
+                if ( jp.parse() )
+                    jp.accept();
+                else
+                {
+                    failed = true;
+                    break;
+                }
+            if ( t )
+                out[t][0] = ',';
+        }
+    };
+
+    vector<thread> pool;
+    for ( unsigned i = 0 ; i < threads ; i++ )
+        pool.emplace_back(work);
+    for ( auto &t : pool )
+        t.join();
+    if ( failed )
+        return false;
+
+    for ( auto &s : out )
+    {
+        cout << s;
+        string().swap(s);
+    }
+    cout << (tabsize ? "\n]" : " ]") << '\n';
+    return true;
+}
+
+// Counts values by type, building nothing
+class counter : public json::handler
+{
+public:
+
+    unsigned long long documents = 0, nulls = 0, booleans = 0, numbers = 0, strings = 0, arrays = 0, objects = 0;
+
+    void end_document() { documents++; }
+    void null() { nulls++; }
+    void boolean(bool) { booleans++; }
+    void number(double) { numbers++; }
+    void string(string_view) { strings++; }
+    void start_array() { arrays++; }
+    void end_array() { }
+    void start_object() { objects++; }
+    void key(string_view) { }
+    void end_object() { }
+};
 
 int main(int argc, char *argv[])
 {
-    size_t tabsize = argc > 1 ? atoi(argv[1]): 4;
+    size_t tabsize = 4;
+    bool ndjson = false, count = false, dom = false;
+    unsigned threads = 0;
+    vector<string> pointers;
+
+    for ( int i = 1 ; i < argc ; i++ )
+        if ( argv[i] == "-n"s )
+            ndjson = true;
+        else if ( argv[i] == "-c"s )
+            count = true;
+        else if ( argv[i] == "-d"s )
+            dom = true;
+        else if ( argv[i] == "-j"s && i + 1 < argc )
+        {
+            threads = atoi(argv[++i]);
+            if ( !threads )
+                threads = max(thread::hardware_concurrency(), 1u);
+        }
+        else if ( argv[i] == "-p"s && i + 1 < argc )
+        {
+            pointers.push_back(argv[++i]);
+            if ( !JsonParser::valid_pointer(pointers.back()) )
+            {
+                cerr << "Invalid JSON Pointer " << pointers.back() << endl;
+                return 1;
+            }
+        }
+        else
+            tabsize = atoi(argv[i]);
 
     if ( tabsize > 16 )
         tabsize = 16;
 
-    JsonParser jp(tabsize);
+    // Print as the values are parsed, through a document, or just count
+    extract_printer w(cout, tabsize);
+    printer p(w);
+    counter c;
+    json::handler &h = count ? static_cast<json::handler &>(c) : dom ? static_cast<json::handler &>(p) : w;
+
+    // Parallel printing reads all input first, and falls back to the serial parser 
+    // (for its errors) if the input is not a valid array
+    bool parallel = threads && !ndjson && !count && !dom && pointers.empty();
+    string input;
+    if ( parallel )
+    {
+        char buf[1 << 16];
+        while ( cin.read(buf, sizeof buf) || cin.gcount() )
+            input.append(buf, cin.gcount());
+        if ( print_parallel(input, tabsize, threads) )
+            return 0;
+    }
+    membuf mb(input.data(), input.length());
+    istream in(parallel ? &mb : cin.rdbuf());
+
+    JsonParser jp = pointers.empty() ? JsonParser(h, ndjson ? JsonParser::NDJSON : JsonParser::DOCUMENT, in) : JsonParser(h, pointers, ndjson, in);
 
     // Parse and execute
-    if ( jp.parse() ) 
+    if ( ndjson )
+    {
+        while ( !jp.done() && jp.parse() )
+            jp.accept();
+        if ( !jp.done() )
+            cerr << jp.get_error() << endl;
+    }
+    else if ( jp.parse() ) 
         jp.accept();
     else
         cerr << jp.get_error() << endl;
-}
-
 
+    if ( count )
+        cout << c.documents << " documents, " << c.objects << " objects, " << c.arrays << " arrays, " << c.strings << " strings, " 
+             << c.numbers << " numbers, " << c.booleans << " booleans, " << c.nulls << " nulls" << endl;
+}
@@ -0,0 +1,451 @@
+#ifndef JSON_PARSER_H_INCLUDED
+#define JSON_PARSER_H_INCLUDED
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "peg.h"
+#include "handler.h"
+#include "scalar.h"
+#include "schema.h"
+
+// Parses JSON documents, passing their values to a handler
+class JsonParser : public peg::Parser<>
+{
+    struct grammar;
+
+    json::handler &handler;
+    bool eof = false;
+
+    std::string buf;            // unescaped strings
+
+    // A JSON Pointer, with its reference tokens as keys and as array indexes
+    struct pointer
+    {
+        std::string text;
+        std::vector<std::string> keys;
+        std::vector<long long> indexes; // -1 if not an index
+    };
+
+    // What to do with the next value in lazy mode
+    enum lazy_mode { EXTRACT, DESCEND, SKIP };
+
+    std::vector<pointer> pointers;
+    std::vector<unsigned> cand;                 // pointers to the next value or below it
+    std::vector<std::vector<unsigned>> live;    // pointers below each open array or object
+    std::vector<long long> counts;              // elements of each open array so far
+    std::vector<unsigned> found;                // pointers of the values extracted, in order
+    std::size_t next_found = 0;
+    lazy_mode mode = SKIP;
+    unsigned target = 0;                        // pointer to the next value
+
+    const json::schema *root = nullptr;
+    const json::schema *next = nullptr;         // schema of the next value, null if skipped
+    std::vector<const json::schema *> bound;    // schemas of the open arrays and objects
+
+    // Pass a number to the handler, as an integer if it is exact
+    void number(std::string_view s)
+    {
+        std::int64_t i;
+        if ( json::parse_integer(s, i) )
+            handler.integer(i);
+        else
+            handler.number(json::parse_number(s));
+    }
+
+    // Lazy mode: extract the next value if some pointer ends there, descend into it if 
+    // some pointer goes through it, or else skip it
+    void choose()
+    {
+        mode = SKIP;
+        for ( auto c : cand )
+            if ( pointers[c].keys.size() == live.size() )
+            {
+                mode = EXTRACT;
+                target = c;
+                return;
+            }
+            else
+                mode = DESCEND;
+    }
+
+    void start_lazy()
+    {
+        live.clear();
+        counts.clear();
+        found.clear();
+        next_found = 0;
+        cand.clear();
+        for ( unsigned c = 0 ; c < pointers.size() ; c++ )
+            cand.push_back(c);
+        choose();
+    }
+
+    void enter()
+    {
+        live.push_back(cand);
+        counts.push_back(0);
+    }
+
+    void leave()
+    {
+        live.pop_back();
+        counts.pop_back();
+    }
+
+    void select_key(std::string_view key)
+    {
+        std::size_t d = live.size() - 1;
+        cand.clear();
+        for ( auto c : live.back() )
+            if ( pointers[c].keys[d] == key )
+                cand.push_back(c);
+        choose();
+    }
+
+    void select_index()
+    {
+        std::size_t d = live.size() - 1;
+        long long i = counts.back()++;
+        cand.clear();
+        for ( auto c : live.back() )
+            if ( pointers[c].indexes[d] == i )
+                cand.push_back(c);
+        choose();
+    }
+
+    void extract()
+    {
+        handler.pointer(pointers[found[next_found++]].text);
+        handler.start_document();
+    }
+
+    // Bound mode: the schema of the next value is known while parsing, so its type is
+    // checked and members it does not bind are skipped
+    bool accepts(unsigned kind) const { return next->kinds() & kind; }
+
+    // Numbers that do not fit the type bound are errors, as other types are
+    bool accepts_number(std::string_view s) const
+    {
+        std::int64_t i;
+        if ( json::parse_integer(s, i) )
+            return next->accepts_integer(i);
+        return next->accepts_number(json::parse_number(s));
+    }
+
+    void start_bound()
+    {
+        bound.clear();
+        next = root;
+    }
+
+    void enter_bound() { bound.push_back(next); }
+
+    // Also on failure, restoring the schema of the array or object
+    void leave_bound()
+    {
+        next = bound.back();
+        bound.pop_back();
+    }
+
+    void select_member(std::string_view key)
+    {
+        const json::schema *s = bound.back()->inner();
+        int i = s->find(key);
+        next = i < 0 ? nullptr : s->member(i);
+    }
+
+    void select_element() { next = bound.back()->inner()->element(); }
+
+public:
+
+    // A single document, documents separated by white space (NDJSON), or array elements 
+    // separated by commas, without document events
+    enum mode_type { DOCUMENT, NDJSON, ELEMENTS };
+
+    // Rules nested at most, about 2000 levels of arrays or objects: deeper documents 
+    // are errors
+    static const unsigned MAXDEPTH = 5000;
+
+    // Parse a single document, or else one document or element per parse() round 
+    JsonParser(json::handler &h, mode_type mode = DOCUMENT, std::istream &in = std::cin);
+
+    // Lazy mode: only pass the values the JSON Pointers lead to, each as a document
+    // after handler::pointer(), in document order. Other values are only checked for 
+    // balanced brackets and strings. Values inside extracted values are not extracted 
+    // again.
+    JsonParser(json::handler &h, const std::vector<std::string> &ptrs, bool ndjson = false, std::istream &in = std::cin);
+
+    // Bound mode: parse into objects through the binder's schema, skipping the members
+    // it does not bind. Values of other types than the schema's, and numbers that do
+    // not fit their type, are errors.
+    JsonParser(json::binder &b, bool ndjson = false, std::istream &in = std::cin);
+
+    // Whether s is a valid JSON Pointer
+    static bool valid_pointer(const std::string &s) { return s.empty() || s[0] == '/'; }
+
+    // The end of input was reached in NDJSON mode
+    bool done() const { return eof; }
+};
+
+// The JSON grammar, built once and shared by all parsers
+struct JsonParser::grammar : peg::Grammar<void, JsonParser>
+{
+    peg::Rule Eof{"Eof"}, WS, LBracket{"LBracket"}, RBracket{"RBracket"}, 
+              LBrace{"LBrace"}, RBrace{"RBrace"}, Colon{"Colon"}, Comma{"Comma"}, 
+              Boolean{"Boolean"}, Null{"Null"}, 
+              Number{"Number"}, Sign, Whole, Fraction, Exponent, 
+              String{"String"}, Key{"String"}, Quoted, Char, PlainChar, EscapedChar, UTF16,
+              Json, Record, Document, Element, Value, Object, Member, Array,
+              Numeral, Scalar, Skipped, Lazy, LazyRecord, LazyDocument, LazyValue, 
+              LazyObject, LazyMember, LazyArray, LazyElement, 
+              Bound, BoundRecord, BoundDocument, BoundValue, BoundObject, BoundMember, 
+              BoundArray, BoundElement, BoundNumber;
+
+    static grammar &get() 
+    { 
+        static grammar g;
+        return g;
+    }
+
+    grammar()
+    {
+        using namespace peg::literals;
+
+        // Tokens
+
+        Eof         =   !peg::Any();
+        WS          =   *" \t\r\n"_ccl;
+
+        LBracket    =   '[' >> WS;
+        RBracket    =   ']' >> WS;
+        LBrace      =   '{' >> WS;
+        RBrace      =   '}' >> WS;
+        Colon       =   ':' >> WS;
+        Comma       =   ',' >> WS;
+
+        Null        =   "null" >> WS                        do_( context().handler.null(); )
+                    ;
+
+        Boolean     =   "true" >> WS                        do_( context().handler.boolean(true); )
+                    |   "false" >> WS                       do_( context().handler.boolean(false); )
+                    ;
+
+        Number      =   Numeral                             do_( context().number(text_view()); )
+                    ;
+        Numeral     =   ( ~Sign >> Whole >> ~Fraction >> ~Exponent )-- >> WS;
+        Sign        =   '-';
+        Whole       =   '0' 
+                    |   "1-9"_ccl >> *"0-9"_ccl
+                    ;
+        Fraction    =   '.' >> +"0-9"_ccl;
+        Exponent    =   "eE"_ccl >> ~"+-"_ccl >> +"0-9"_ccl;
+
+        String      =   Quoted                              do_( context().handler.string(json::unescaped(text_view(), context().buf)); )
+                    ;
+        Key         =   Quoted                              do_( context().handler.key(json::unescaped(text_view(), context().buf)); )
+                    ;
+        Quoted      =   '"' >> ( *Char )-- >> '"' >> WS;
+        Char        =   PlainChar 
+                    |   EscapedChar 
+                    ;
+        PlainChar   =   "^\x00-\x1F\"\\"_ccl;
+        EscapedChar =   '\\' >> ( "\"\\/bfnrt"_ccl | UTF16 );
+        UTF16       =   'u' >> "0-9a-fA-F"_ccl[4];
+
+        // Grammar
+
+        Json        =   Document >> Eof
+                    ;
+
+        // NDJSON: documents separated by white space, one per parse round
+        Record      =   Document
+                    |   WS >> Eof                           do_( context().eof = true; )
+                    ;
+
+        Document    =   WS                                  do_( context().handler.start_document(); )
+                        >> Value                            do_( context().handler.end_document(); )
+                    ;
+
+        // The elements of an array without its brackets, one per parse round
+        Element     =   WS >> Value >> ( Comma | Eof )
+                    ;
+
+        Value       =   Object
+                    |   Array
+                    |   String
+                    |   Number
+                    |   Boolean
+                    |   Null
+                    ;
+
+        Array       =   LBracket                            do_( context().handler.start_array(); )
+                        >> ~( Value >> *( Comma >> Value ) )   
+                        >> RBracket                         do_( context().handler.end_array(); )
+                    ;
+
+        Object      =   LBrace                              do_( context().handler.start_object(); )
+                        >> ~( Member >> *( Comma >> Member ) )
+                        >> RBrace                           do_( context().handler.end_object(); )
+                    ;
+        Member      =   Key >> Colon >> Value;
+
+        // Lazy mode: values are parsed only where some JSON Pointer leads, predicates
+        // choose one way for each value while parsing
+
+        Lazy        =   LazyDocument >> Eof
+                    ;
+
+        LazyRecord  =   LazyDocument
+                    |   WS >> Eof                           do_( context().eof = true; )
+                    ;
+
+        LazyDocument =  WS >> pa_( context().start_lazy(); ) >> LazyValue
+                    ;
+
+        LazyValue   =   if_( context().mode == EXTRACT )    do_( context().extract(); )
+                        >> Value                            do_( context().handler.end_document(); )
+                        >> pa_( context().found.push_back(context().target); )
+                    |   if_( context().mode == DESCEND ) >> ( LazyObject | LazyArray | Scalar )
+                    |   if_( context().mode == SKIP ) >> Skipped
+                    ;
+
+        LazyArray   =   LBracket >> pa_( context().enter(); )
+                        >> ~( LazyElement >> *( Comma >> LazyElement ) )   
+                        >> RBracket >> pa_( context().leave(); )
+                    ;
+        LazyElement =   pa_( context().select_index(); ) >> LazyValue
+                    ;
+
+        LazyObject  =   LBrace >> pa_( context().enter(); )
+                        >> ~( LazyMember >> *( Comma >> LazyMember ) )
+                        >> RBrace >> pa_( context().leave(); )
+                    ;
+        LazyMember  =   Quoted >> pa_( context().select_key(json::unescaped(text_view(), context().buf)); ) 
+                        >> Colon >> LazyValue
+                    ;
+
+        // Bound mode: predicates follow the schema of each value while parsing, the 
+        // binder follows it again when actions run
+
+        Bound       =   BoundDocument >> Eof
+                    ;
+
+        BoundRecord =   BoundDocument
+                    |   WS >> Eof                           do_( context().eof = true; )
+                    ;
+
+        BoundDocument = WS >> pa_( context().start_bound(); ) do_( context().handler.start_document(); )
+                        >> BoundValue                       do_( context().handler.end_document(); )
+                    ;
+
+        BoundValue  =   if_( context().accepts(json::schema::OBJECT) ) >> BoundObject
+                    |   if_( context().accepts(json::schema::ARRAY) ) >> BoundArray
+                    |   if_( context().accepts(json::schema::STRING) ) >> String
+                    |   if_( context().accepts(json::schema::NUMBER) ) >> BoundNumber
+                    |   if_( context().accepts(json::schema::BOOL) ) >> Boolean
+                    |   if_( context().accepts(json::schema::NUL) ) >> Null
+                    ;
+
+        BoundNumber =   Numeral >> if_( context().accepts_number(text_view()) )
+                                                            do_( context().number(text_view()); )
+                    ;
+
+        BoundArray  =   LBracket                            do_( context().handler.start_array(); )
+                        >> pa_( context().enter_bound(); )
+                        >> ( ~( BoundElement >> *( Comma >> BoundElement ) )
+                             >> RBracket                    do_( context().handler.end_array(); )
+                             >> pa_( context().leave_bound(); )
+                           | pr_( context().leave_bound(); return false; )
+                           )
+                    ;
+        BoundElement =  pa_( context().select_element(); ) >> BoundValue
+                    ;
+
+        BoundObject =   LBrace                              do_( context().handler.start_object(); )
+                        >> pa_( context().enter_bound(); )
+                        >> ( ~( BoundMember >> *( Comma >> BoundMember ) )
+                             >> RBrace                      do_( context().handler.end_object(); )
+                             >> pa_( context().leave_bound(); )
+                           | pr_( context().leave_bound(); return false; )
+                           )
+                    ;
+        BoundMember =   Quoted >> pa_( context().select_member(json::unescaped(text_view(), context().buf)); )
+                        >> ( if_( context().next )          do_( context().handler.key(json::unescaped(text_view(), context().buf)); )
+                             >> Colon >> BoundValue
+                           | if_( !context().next ) >> Colon >> Skipped
+                           )
+                    ;
+
+        // Values skipped without actions, arrays and objects by a bracket-matching scan
+        Skipped     =   peg::Balanced("[]{}") >> WS
+                    |   Scalar
+                    ;
+        Scalar      =   Quoted 
+                    |   Numeral 
+                    |   "true" >> WS 
+                    |   "false" >> WS 
+                    |   "null" >> WS
+                    ;
+
+        // Numbers, strings and white space run as DFAs. Escapes are factored above
+        // so that the next character tells which way a string goes.
+        peg::Compile(Json);
+        peg::Compile(Record);
+        peg::Compile(Element);
+        peg::Compile(Lazy);
+        peg::Compile(LazyRecord);
+        peg::Compile(Bound);
+        peg::Compile(BoundRecord);
+    }
+};
+
+inline JsonParser::JsonParser(json::handler &h, mode_type mode, std::istream &in) : 
+    Parser(mode == NDJSON ? grammar::get().Record : mode == ELEMENTS ? grammar::get().Element : grammar::get().Json, in), handler(h) 
+{ 
+    limit_depth(MAXDEPTH); 
+}
+
+inline JsonParser::JsonParser(json::binder &b, bool ndjson, std::istream &in) : 
+    Parser(ndjson ? grammar::get().BoundRecord : grammar::get().Bound, in), handler(b), root(&b.get_schema()) 
+{ 
+    limit_depth(MAXDEPTH); 
+}
+
+inline JsonParser::JsonParser(json::handler &h, const std::vector<std::string> &ptrs, bool ndjson, std::istream &in) : 
+    Parser(ndjson ? grammar::get().LazyRecord : grammar::get().Lazy, in), handler(h) 
+{
+    limit_depth(MAXDEPTH);
+
+    // Split pointers into reference tokens, unescaping ~1 and ~0
+    for ( const auto &text : ptrs )
+    {
+        pointer p { text, { }, { } };
+        for ( std::size_t b = 1, e ; b <= text.length() ; b = e + 1 )
+        {
+            e = std::min(text.find('/', b), text.length());
+
+            std::string key;
+            for ( std::size_t i = b ; i < e ; i++ )
+                if ( text[i] == '~' && i + 1 < e && (text[i + 1] == '0' || text[i + 1] == '1') )
+                    key += text[++i] == '0' ? '~' : '/';
+                else
+                    key += text[i];
+
+            // Array indexes have no leading zeros
+            long long index = -1;
+            if ( !key.empty() && key.length() <= 18 && key.find_first_not_of("0123456789") == std::string::npos && (key == "0" || key[0] != '0') )
+                index = std::stoll(key);
+
+            p.keys.push_back(key);
+            p.indexes.push_back(index);
+        }
+        pointers.push_back(p);
+    }
+}
+
+#endif
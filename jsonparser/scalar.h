@@ -0,0 +1,177 @@
+#ifndef JSON_SCALAR_H_INCLUDED
+#define JSON_SCALAR_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <system_error>
+#include <cmath>
+
+namespace json
+{
+    // Append code point c to out as utf8
+    inline void append_utf8(std::string &out, char32_t c)
+    {
+        if ( c < 0x80 )
+            out += char(c);
+        else if ( c < 0x800 )
+        {
+            out += char(0xC0 | c >> 6);
+            out += char(0x80 | (c & 0x3F));
+        }
+        else if ( c < 0x10000 )
+        {
+            out += char(0xE0 | c >> 12);
+            out += char(0x80 | (c >> 6 & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            out += char(0xF0 | c >> 18);
+            out += char(0x80 | (c >> 12 & 0x3F));
+            out += char(0x80 | (c >> 6 & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+    }
+
+    // The value of 4 hex digits
+    inline char32_t hex4(const char *p)
+    {
+        char32_t u = 0;
+        for ( int i = 0 ; i < 4 ; i++ )
+        {
+            char c = p[i];
+            u = u << 4 | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        }
+        return u;
+    }
+
+    // Append the body of a JSON string (between the quotes), with escapes already checked
+    // by the grammar, to out in one pass. Surrogate pairs are combined, lone surrogates
+    // become U+FFFD.
+    inline void unescape(std::string_view s, std::string &out)
+    {
+        const char *p = s.data(), *q = p + s.length();
+
+        while ( p < q )
+        {
+            // Copy up to the next escape at once
+            const char *e = static_cast<const char *>(std::char_traits<char>::find(p, q - p, '\\'));
+            if ( !e )
+                e = q;
+            out.append(p, e);
+            if ( e == q )
+                break;
+
+            p = e + 2;
+            switch ( e[1] )
+            {
+                case 'b':   out += '\b';    break;
+                case 'f':   out += '\f';    break;
+                case 'n':   out += '\n';    break;
+                case 'r':   out += '\r';    break;
+                case 't':   out += '\t';    break;
+                case 'u':
+                {
+                    char32_t u = hex4(p);
+                    p += 4;
+                    if ( u >= 0xD800 && u < 0xDC00 && q - p >= 6 && p[0] == '\\' && p[1] == 'u' )
+                    {
+                        char32_t l = hex4(p + 2);
+                        if ( l >= 0xDC00 && l < 0xE000 )
+                        {
+                            u = 0x10000 + ((u - 0xD800) << 10) + (l - 0xDC00);
+                            p += 6;
+                        }
+                    }
+                    if ( u >= 0xD800 && u < 0xE000 )
+                        u = 0xFFFD;
+                    append_utf8(out, u);
+                    break;
+                }
+                default:    out += e[1];    break;      // " \ /
+            }
+        }
+    }
+
+    // The value of a JSON string body: s itself if it has no escapes, or s unescaped
+    // into buf, whose memory is reused
+    inline std::string_view unescaped(std::string_view s, std::string &buf)
+    {
+        if ( s.find('\\') == std::string_view::npos )
+            return s;
+        buf.clear();
+        unescape(s, buf);
+        return buf;
+    }
+
+    // Exact value of a JSON number without fraction or exponent, of up to 18 digits
+    inline bool parse_integer(std::string_view s, std::int64_t &i)
+    {
+        const char *p = s.data(), *q = p + s.length();
+        bool neg = p < q && *p == '-';
+        p += neg;
+        if ( p == q || q - p > 18 )
+            return false;
+
+        std::int64_t v = 0;
+        for ( ; p < q ; p++ )
+        {
+            unsigned d = *p - '0';
+            if ( d > 9 )
+                return false;
+            v = v * 10 + d;
+        }
+        if ( neg && !v )            // -0 is a double
+            return false;
+        i = neg ? -v : v;
+        return true;
+    }
+
+    // The power of ten of the first nonzero digit of a JSON number without sign, as
+    // in 1.5e3 -> 3 or 0.05 -> -2, saturated far beyond the range of doubles
+    inline long long decimal_exponent(std::string_view s)
+    {
+        static const long long LIMIT = 1000000;
+
+        std::size_t e = s.find_first_of("eE"), dot = s.find('.');
+        std::string_view mantissa = s.substr(0, e);
+        std::size_t first = mantissa.find_first_of("123456789");
+        if ( first == std::string_view::npos )
+            return 0;
+        std::size_t point = dot < mantissa.length() ? dot : mantissa.length();
+        long long x = first < point ? (long long)(point - first) - 1 : -(long long)(first - point);
+
+        if ( e != std::string_view::npos )
+        {
+            const char *p = s.data() + e + 1, *q = s.data() + s.length();
+            bool neg = *p == '-';
+            p += *p == '-' || *p == '+';
+            long long v = 0;
+            for ( ; p < q && v < LIMIT ; p++ )
+                v = v * 10 + (*p - '0');
+            x += neg ? -v : v;
+        }
+        return x;
+    }
+
+    // Value of a JSON number, independent of the locale
+    inline double parse_number(std::string_view s)
+    {
+        double d = 0;
+        if ( std::from_chars(s.data(), s.data() + s.length(), d).ec == std::errc::result_out_of_range )
+        {
+            // Underflow to zero or overflow to infinity, by the sign of the decimal
+            // exponent of the first significant digit
+            bool neg = s[0] == '-';
+            d = decimal_exponent(s.substr(neg)) < 0 ? 0.0 : HUGE_VAL;
+            if ( neg )
+                d = -d;
+        }
+        return d;
+    }
+
+} // namespace json
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef JSON_SCHEMA_H_INCLUDED
+#define JSON_SCHEMA_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <initializer_list>
+#include <type_traits>
+#include <limits>
+#include <cmath>
+
+#include "handler.h"
+
+namespace json
+{
+    // How JSON values map to a C++ type. Parsers ask a schema which values it accepts
+    // and which members it binds while parsing; binders ask it to store values into
+    // objects of its type, passed as void *, when actions run.
+    class schema
+    {
+    public:
+
+        enum kind_mask { NUL = 1, BOOL = 2, NUMBER = 4, STRING = 8, ARRAY = 16, OBJECT = 32 };
+
+        virtual ~schema() = default;
+
+        // Parse time
+        virtual unsigned kinds() const = 0;                                 // values accepted
+        virtual const schema *inner() const { return this; }                // the schema of an array's or object's contents
+        virtual int find(std::string_view key) const { return -1; }         // the member bound to key, -1 if skipped
+        virtual const schema *member(unsigned i) const { return nullptr; }
+        virtual const schema *element() const { return nullptr; }
+        virtual bool accepts_number(double d) const { return true; }        // numbers that can be stored
+        virtual bool accepts_integer(std::int64_t i) const { return accepts_number(double(i)); }
+
+        // Accept time
+        virtual void null(void *obj) const { }
+        virtual void boolean(void *obj, bool b) const { }
+        virtual void number(void *obj, double d) const { }
+        virtual void integer(void *obj, std::int64_t i) const { number(obj, double(i)); }
+        virtual void string(void *obj, std::string_view s) const { }
+        virtual void *open(void *obj) const { return obj; }                 // an array or object starts: the object filled with its contents
+        virtual void *member_at(void *obj, unsigned i) const { return nullptr; }
+        virtual void *append(void *obj) const { return nullptr; }          // a new element
+    };
+
+    template <typename T> struct is_vector : std::false_type { };
+    template <typename T> struct is_vector<std::vector<T>> : std::true_type { };
+
+    template <typename T> struct is_optional : std::false_type { };
+    template <typename T> struct is_optional<std::optional<T>> : std::true_type { };
+
+    template <typename T> constexpr bool is_scalar_v = std::is_arithmetic_v<T> || std::is_same_v<T, std::string>;
+
+    // The type inside vectors and optionals
+    template <typename T, typename = void> struct leaf { using type = T; };
+    template <typename T> struct leaf<T, std::enable_if_t<is_vector<T>::value || is_optional<T>::value>> : leaf<typename T::value_type> { };
+
+    // Booleans, numbers and strings. Integral types only accept whole numbers in their
+    // range, floating types numbers in theirs, so numbers are stored unchanged but for
+    // rounding.
+    template <typename T> class scalar_schema : public schema
+    {
+        static T &get(void *obj) { return *static_cast<T *>(obj); }
+
+    public:
+
+        unsigned kinds() const
+        {
+            if constexpr ( std::is_same_v<T, bool> )
+                return BOOL;
+            else if constexpr ( std::is_arithmetic_v<T> )
+                return NUMBER;
+            else
+                return STRING;
+        }
+
+        bool accepts_number(double d) const
+        {
+            if constexpr ( std::is_integral_v<T> )
+                return d == std::trunc(d) && d >= double(std::numeric_limits<T>::lowest()) && d < std::ldexp(1.0, std::numeric_limits<T>::digits);
+            else if constexpr ( std::is_floating_point_v<T> )
+                return !std::isfinite(d) || std::fabs(d) <= std::numeric_limits<T>::max();
+            else
+                return false;
+        }
+
+        bool accepts_integer(std::int64_t i) const
+        {
+            if constexpr ( std::is_integral_v<T> && std::is_signed_v<T> )
+                return i >= std::numeric_limits<T>::lowest() && i <= std::numeric_limits<T>::max();
+            else if constexpr ( std::is_integral_v<T> )
+                return i >= 0 && std::uint64_t(i) <= std::numeric_limits<T>::max();
+            else
+                return accepts_number(double(i));
+        }
+
+        void boolean(void *obj, bool b) const
+        {
+            if constexpr ( std::is_same_v<T, bool> )
+                get(obj) = b;
+        }
+
+        void number(void *obj, double d) const
+        {
+            if constexpr ( std::is_arithmetic_v<T> && !std::is_same_v<T, bool> )
+                get(obj) = static_cast<T>(d);
+        }
+
+        void integer(void *obj, std::int64_t i) const
+        {
+            if constexpr ( std::is_arithmetic_v<T> && !std::is_same_v<T, bool> )
+                get(obj) = static_cast<T>(i);
+        }
+
+        void string(void *obj, std::string_view s) const
+        {
+            if constexpr ( std::is_same_v<T, std::string> )
+                get(obj).assign(s);
+        }
+    };
+
+    // Arrays, cleared when they start
+    template <typename E> class vector_schema : public schema
+    {
+        static_assert(!std::is_same_v<E, bool>, "vector<bool> elements cannot be bound");
+
+        std::shared_ptr<const schema> elem;
+
+        static std::vector<E> &get(void *obj) { return *static_cast<std::vector<E> *>(obj); }
+
+    public:
+
+        vector_schema(std::shared_ptr<const schema> e) : elem(std::move(e)) { }
+
+        unsigned kinds() const { return ARRAY; }
+        const schema *element() const { return elem.get(); }
+
+        void *open(void *obj) const
+        {
+            get(obj).clear();
+            return obj;
+        }
+
+        void *append(void *obj) const { return &get(obj).emplace_back(); }
+    };
+
+    // Values that may be null, or absent and left empty
+    template <typename E> class optional_schema : public schema
+    {
+        std::shared_ptr<const schema> elem;
+
+        static void *set(void *obj) { return &static_cast<std::optional<E> *>(obj)->emplace(); }
+
+    public:
+
+        optional_schema(std::shared_ptr<const schema> e) : elem(std::move(e)) { }
+
+        unsigned kinds() const { return elem->kinds() | NUL; }
+        const schema *inner() const { return elem->inner(); }
+        bool accepts_number(double d) const { return elem->accepts_number(d); }
+        bool accepts_integer(std::int64_t i) const { return elem->accepts_integer(i); }
+
+        void null(void *obj) const { static_cast<std::optional<E> *>(obj)->reset(); }
+        void boolean(void *obj, bool b) const { elem->boolean(set(obj), b); }
+        void number(void *obj, double d) const { elem->number(set(obj), d); }
+        void integer(void *obj, std::int64_t i) const { elem->integer(set(obj), i); }
+        void string(void *obj, std::string_view s) const { elem->string(set(obj), s); }
+        void *open(void *obj) const { return elem->open(set(obj)); }
+    };
+
+    // The schema of M, whose objects (in vectors or optionals) have schema obj
+    template <typename M> std::shared_ptr<const schema> make_schema(const schema *obj = nullptr)
+    {
+        if constexpr ( is_vector<M>::value )
+            return std::make_shared<vector_schema<typename M::value_type>>(make_schema<typename M::value_type>(obj));
+        else if constexpr ( is_optional<M>::value )
+            return std::make_shared<optional_schema<typename M::value_type>>(make_schema<typename M::value_type>(obj));
+        else if constexpr ( is_scalar_v<M> )
+            return std::make_shared<scalar_schema<M>>();
+        else
+            return std::shared_ptr<const schema>(std::shared_ptr<const schema>(), obj);    // not owned
+    }
+
+    // Objects bound to the members of a T, reset to T() when they start. Other members
+    // are skipped. Schemas of nested objects are referenced, not copied, so they must
+    // live as long as this one, and a schema can refer to itself:
+    //
+    //      struct node { std::string name; std::vector<node> children; };
+    //      static const object_schema<node> s { { "name", &node::name }, { "children", &node::children, s } };
+    template <typename T> class object_schema : public schema
+    {
+        struct entry
+        {
+            std::string name;
+            std::shared_ptr<const schema> s;
+            std::function<void *(void *)> at;
+        };
+
+        std::vector<entry> entries;
+        std::unordered_map<std::string_view, unsigned> index;
+
+    public:
+
+        // Binds a JSON member to a member of T
+        class field
+        {
+            friend class object_schema;
+            entry e;
+
+        public:
+
+            // Booleans, numbers, strings, and vectors or optionals of them
+            template <typename M> field(std::string name, M T::*m) :
+                e{ std::move(name), make_schema<M>(), [m](void *p) -> void * { return &(static_cast<T *>(p)->*m); } }
+            {
+                static_assert(is_scalar_v<typename leaf<M>::type>, "objects need their schema");
+            }
+
+            // Objects, and vectors or optionals of them
+            template <typename M, typename U> field(std::string name, M T::*m, const object_schema<U> &os) :
+                e{ std::move(name), make_schema<M>(&os), [m](void *p) -> void * { return &(static_cast<T *>(p)->*m); } }
+            {
+                static_assert(std::is_same_v<typename leaf<M>::type, U>, "wrong schema");
+            }
+        };
+
+        object_schema(std::initializer_list<field> fields)
+        {
+            entries.reserve(fields.size());
+            for ( const auto &f : fields )
+                entries.push_back(f.e);
+            for ( unsigned i = 0 ; i < entries.size() ; i++ )
+                index.emplace(entries[i].name, i);
+        }
+
+        object_schema(const object_schema &) = delete;
+
+        unsigned kinds() const { return OBJECT; }
+
+        int find(std::string_view key) const
+        {
+            auto i = index.find(key);
+            return i == index.end() ? -1 : int(i->second);
+        }
+
+        const schema *member(unsigned i) const { return entries[i].s.get(); }
+
+        void *open(void *obj) const
+        {
+            *static_cast<T *>(obj) = T();
+            return obj;
+        }
+
+        void *member_at(void *obj, unsigned i) const { return entries[i].at(obj); }
+    };
+
+    // A handler storing the values of each document into an object through its schema.
+    // Values are expected to fit the schema, as parsers in bound mode check (see
+    // JsonParser): derive from it to use each object as its document ends.
+    class binder : public handler
+    {
+        // An open array or object
+        struct frame
+        {
+            void *obj;
+            const schema *s;
+            bool array;
+        };
+
+        const schema &root_schema;
+        void *root;
+
+        std::vector<frame> levels;
+        frame next { };                 // a member's value
+
+        // Where the next value goes
+        frame target()
+        {
+            if ( levels.empty() )
+                return { root, &root_schema, false };
+            frame &f = levels.back();
+            if ( f.array )
+                return { f.s->append(f.obj), f.s->element(), false };
+            return next;
+        }
+
+        void open(bool array)
+        {
+            frame t = target();
+            levels.push_back({ t.s->open(t.obj), t.s->inner(), array });
+        }
+
+    public:
+
+        binder(const schema &s, void *obj) : root_schema(s), root(obj) { }
+
+        const schema &get_schema() const { return root_schema; }
+
+        void start_document() { levels.clear(); }
+
+        void null() { frame t = target(); t.s->null(t.obj); }
+        void boolean(bool b) { frame t = target(); t.s->boolean(t.obj, b); }
+        void number(double d) { frame t = target(); t.s->number(t.obj, d); }
+        void integer(std::int64_t i) { frame t = target(); t.s->integer(t.obj, i); }
+        void string(std::string_view s) { frame t = target(); t.s->string(t.obj, s); }
+
+        void start_array() { open(true); }
+        void end_array() { levels.pop_back(); }
+
+        void start_object() { open(false); }
+        void key(std::string_view k)
+        {
+            frame &f = levels.back();
+            unsigned i = f.s->find(k);
+            next = { f.s->member_at(f.obj, i), f.s->member(i), false };
+        }
+        void end_object() { levels.pop_back(); }
+    };
+
+} // namespace json
+
+#endif
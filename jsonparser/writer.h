@@ -0,0 +1,283 @@
+#ifndef JSON_WRITER_H_INCLUDED
+#define JSON_WRITER_H_INCLUDED
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <variant>
+#include <ostream>
+#include <charconv>
+
+#include "handler.h"
+#include "dom.h"
+#include "json.h"
+
+namespace json
+{
+    // A handler writing JSON text in one pass, compact or indented by tabsize spaces.
+    // Output is appended to a string, or written to a stream through a buffer of about
+    // BUFSIZE bytes. Memory use only depends on the nesting depth.
+    class writer : public handler
+    {
+        static const std::size_t BUFSIZE = 1 << 16;
+
+        // An open array or object
+        struct level
+        {
+            char open, close;
+            bool deferred;              // not opened yet: a member's value, opened on a new line if not empty
+            std::size_t count;          // values or members
+        };
+
+        std::ostream *os = nullptr;
+        std::string buf;
+        std::string &out;
+        unsigned tabsize;
+
+        std::vector<level> levels;
+        bool member = false;            // the next value is a member's
+
+        void indent(std::size_t n) { out.append(n * tabsize, ' '); }
+
+        void flush_if_full()
+        {
+            if ( os && out.size() >= BUFSIZE )
+                flush();
+        }
+
+        // Start a new value or member in the innermost container
+        void next(level &l)
+        {
+            if ( l.count++ )
+                out += tabsize ? ",\n" : ", ";
+            else
+            {
+                if ( l.deferred )
+                {
+                    out += '\n';
+                    indent(levels.size() - 1);
+                    out += l.open;
+                }
+                out += tabsize ? '\n' : ' ';
+            }
+        }
+
+        // Separate and indent a value, unless it follows its key
+        void begin_value()
+        {
+            flush_if_full();
+            if ( member || levels.empty() )
+                return;
+            next(levels.back());
+            indent(levels.size());
+        }
+
+        void open(char o, char c)
+        {
+            begin_value();
+            levels.push_back({ o, c, member && tabsize, 0 });
+            if ( !levels.back().deferred )
+                out += o;
+            member = false;
+        }
+
+        void close()
+        {
+            level l = levels.back();
+            levels.pop_back();
+
+            if ( !l.count )
+            {
+                if ( l.deferred )
+                    out += l.open;
+                out += ' ';
+            }
+            else if ( tabsize )
+            {
+                out += '\n';
+                indent(levels.size());
+            }
+            else
+                out += ' ';
+            out += l.close;
+            flush_if_full();
+        }
+
+        // Write a string, copying runs of characters that need no escapes at once
+        void quote(std::string_view s)
+        {
+            static const char hex[] = "0123456789abcdef";
+            const char *p = s.data(), *q = p + s.length();
+
+            out += '"';
+            while ( p < q )
+            {
+                const char *r = p;
+                while ( r < q && static_cast<unsigned char>(*r) >= 0x20 && *r != '"' && *r != '\\' && *r != '/' )
+                    r++;
+                out.append(p, r);
+                if ( r == q )
+                    break;
+
+                out += '\\';
+                switch ( char c = *r )
+                {
+                    case '"':
+                    case '\\':
+                    case '/':   out += c;       break;
+                    case '\b':  out += 'b';     break;
+                    case '\f':  out += 'f';     break;
+                    case '\n':  out += 'n';     break;
+                    case '\r':  out += 'r';     break;
+                    case '\t':  out += 't';     break;
+                    default:
+                        out += "u00";
+                        out += hex[c >> 4];
+                        out += hex[c & 0xF];
+                        break;
+                }
+                p = r + 1;
+            }
+            out += '"';
+        }
+
+        template <typename T> void chars(T v)
+        {
+            char s[32];
+            out.append(s, std::to_chars(s, s + sizeof s, v).ptr);
+        }
+
+        void write(const variant_type &v)
+        {
+            std::visit([this](const auto &x) { write(x); }, v);
+        }
+
+        void write(null_type) { null(); }
+        void write(bool_type b) { boolean(b); }
+        void write(number_type d) { number(d); }
+        void write(const string_type &s) { string(s); }
+
+        void write(const array_type &a)
+        {
+            start_array();
+            for ( const auto &v : a )
+                write(v);
+            end_array();
+        }
+
+        void write(const object_type &o)
+        {
+            start_object();
+            for ( const auto &[k, v] : o )
+            {
+                key(k);
+                write(v);
+            }
+            end_object();
+        }
+
+    public:
+
+        writer(std::string &s, unsigned tabsize = 0) : out(s), tabsize(tabsize) { }
+        writer(std::ostream &os, unsigned tabsize = 0) : os(&os), out(buf), tabsize(tabsize) { buf.reserve(BUFSIZE + BUFSIZE / 4); }
+        ~writer() { flush(); }
+
+        // Write buffered output to the stream
+        void flush()
+        {
+            if ( !os )
+                return;
+            os->write(out.data(), out.size());
+            out.clear();
+        }
+
+        // Write text as it is, e.g. between documents
+        void text(std::string_view s) { out += s; }
+
+        // Documents end with a new line
+        void end_document()
+        {
+            out += '\n';
+            flush_if_full();
+        }
+
+        void null() { begin_value(); out += "null"; member = false; }
+        void boolean(bool b) { begin_value(); out += b ? "true" : "false"; member = false; }
+        void integer(std::int64_t i) { begin_value(); chars(i); member = false; }
+        void string(std::string_view s) { begin_value(); quote(s); member = false; }
+
+        // Shortest text that reads back the same. JSON has no infinities or NaN.
+        void number(double d)
+        {
+            begin_value();
+            if ( std::isfinite(d) )
+                chars(d);
+            else
+                out += "null";
+            member = false;
+        }
+
+        void start_array() { open('[', ']'); }
+        void end_array() { close(); }
+
+        void start_object() { open('{', '}'); }
+        void key(std::string_view s)
+        {
+            flush_if_full();
+            next(levels.back());
+            indent(levels.size());
+            quote(s);
+            out += ": ";
+            member = true;
+        }
+        void end_object() { close(); }
+
+        // Write a whole document
+        void write(const value &v)
+        {
+            start_document();
+            write_value(v);
+            end_document();
+        }
+
+        void write(const json_type &v)
+        {
+            start_document();
+            write(static_cast<const variant_type &>(v));
+            end_document();
+        }
+
+    private:
+
+        void write_value(const value &v)
+        {
+            switch ( v.kind() )
+            {
+                case value::BOOL:       boolean(v.as_bool());       break;
+                case value::NUMBER:     number(v.as_number());      break;
+                case value::STRING:     string(v.as_string());      break;
+                case value::ARRAY:
+                    start_array();
+                    for ( const auto &e : v.as_array() )
+                        write_value(e);
+                    end_array();
+                    break;
+                case value::OBJECT:
+                    start_object();
+                    for ( const auto &[k, e] : v.as_object() )
+                    {
+                        key(k);
+                        write_value(e);
+                    }
+                    end_object();
+                    break;
+                default:                null();                     break;
+            }
+        }
+    };
+
+} // namespace json
+
+#endif
@@ -1,18 +1,23 @@
-// A simple palindrome recognizer
+// A simple palindrome recognizer.
+// Memoizes characters if some argument is given in the command line.
 
 #include <string>
 #include <iostream>
 
+//#define PEG_HEATMAP          // Uncomment for a backtracking heatmap on standard error
+
 #include "peg.h"
 
 using namespace std;
 using namespace peg;
 
-int main()
+int main(int argc, char *argv[])
 {
+    static bool memoize = argc > 1;
+
     class pal_parser : public Parser<string>
     {
-        Rule start, pal, chr;
+        Rule start, pal, chr{memoize};
 
     public:
 
@@ -28,6 +33,11 @@ int main()
 
             chr     = Any()--               pa_( val(0) = text(); )  
                     ;       
+
+            // Rule names for the heatmap
+            peg_debug(start);
+            peg_debug(pal);
+            peg_debug(chr);
         }
     };
 
@@ -35,5 +45,9 @@ int main()
 
     while ( p.parse() )
         p.accept();
+
+#ifdef PEG_HEATMAP
+    p.heatmap_report(cerr);
+#endif
 }
 
@@ -0,0 +1,71 @@
+// Searches for the inputs that make the palindrome recognizer of pal.cc work hardest.
+// Memoizes characters if some argument is given in the command line.
+
+#include <string>
+#include <iostream>
+
+#define PEG_STATS
+
+#include "peg.h"
+
+using namespace std;
+using namespace peg;
+
+static bool memoize;
+
+class pal_parser : public Parser<string>
+{
+    struct grammar;
+
+public:
+
+    pal_parser(istream &in);
+
+    static Rule &start();
+};
+
+struct pal_parser::grammar : Grammar<string, pal_parser>
+{
+    Rule start, pal, chr{memoize};
+
+    static grammar &get()
+    {
+        static grammar g;
+        return g;
+    }
+
+    grammar()
+    {
+        start   = pal--
+                ;
+
+        pal     = chr >> pal >> chr     if_( val(0) == val(2) )
+                | chr >> chr            if_( val(0) == val(1) )
+                | chr
+                ;
+
+        chr     = Any()--               pa_( val(0) = text(); )
+                ;
+    }
+};
+
+pal_parser::pal_parser(istream &in) : Parser(start(), in) { }
+
+Rule &pal_parser::start() { return grammar::get().start; }
+
+int main(int argc, char *argv[])
+{
+    memoize = argc > 1;
+
+    SlowInputs finder(pal_parser::start(), [ ](istream &in)
+    {
+        pal_parser p(in);
+        while ( p.parse() )
+            p.accept();
+    });
+
+    for ( auto s : { "abcba", "aaaa", "abcdefgh", "racecar" } )
+        finder.sample(s);
+    finder.search(2000, 64);
+    finder.report(cout);
+}
@@ -2,8 +2,10 @@
 #define PEG_H_INCLUDED
 
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <set>
@@ -11,21 +13,78 @@
 #include <utility>
 #include <functional>
 #include <exception>
+#include <stdexcept>
 #include <algorithm>
-#include <codecvt>
-#include <locale>
 #include <variant>
 #include <memory>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#ifdef PEG_STATS
+#include <random>
+#include <sstream>
+#include <cmath>
+#endif
+#if defined(PEG_PROFILE) || defined(PEG_TRACE) || defined(PEG_HEATMAP)
+#include <chrono>
+#include <cstdlib>
+#endif
+#ifdef __linux__
+#include <ucontext.h>
+#endif
+#ifdef PEG_PROFILE_PERF
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
     
 
 namespace peg
 {
     class Expr;
     class Rule;
+    class Tracer;
+    class Tree;
     template <typename T> class Parser;
+    namespace details { class analyzer; class compiler; }
+
+    // How parsers make the characters that Lit(char32_t), Ccl and Any match from input
+    // bytes (see parser.set_encoding()). Strings always match bytes.
+    enum class Encoding 
+    { 
+        UTF8,       // utf8 sequences are single characters, the default
+        BYTES,      // bytes are characters, and classes are read as bytes
+        LATIN1      // bytes are characters, and classes are read as utf8: "à-ÿ" matches bytes 0xE0 to 0xFF
+    };
+
+#ifdef PEG_STATS
+    // Engine work counters, kept per thread when PEG_STATS is defined
+    struct Stats
+    {
+        unsigned long long bytes = 0;           // input bytes read by the matcher, counting re-reads
+        unsigned long long rules = 0;           // rule invocations
+        unsigned long long backtracks = 0;      // backtracks to a mark
+        unsigned long long memo = 0;            // memo entries created
+        unsigned long long memo_peak = 0;       // largest memo size
+    };
+
+    inline thread_local Stats stats;
+#endif
 
     namespace details
     {
+        // Input positions within a parse round, 64-bit if PEG_POS64 is defined for 
+        // rounds over 4 GB of input
+#ifdef PEG_POS64
+        using pos_t = std::uint64_t;
+#else
+        using pos_t = unsigned;
+#endif
+
         // An auto-resizing vector
         template <typename T> 
         class vect : public std::vector<T>
@@ -44,11 +103,166 @@ namespace peg
             }
         };
 
+#ifdef PEG_HEATMAP
+        // Backtracking heatmap.
+        // Counts how many times each input byte of a statement (a parse round that is 
+        // accepted) is read and rewound over, and blames re-reads on the innermost rule 
+        // running when they happen. Keeps the statements with the highest amplification
+        // (bytes read / bytes accepted) and, for each, its hottest region.
+        class heatmap
+        {
+        public:
+
+            static const unsigned REGION = 32;      // bytes per region
+            static const unsigned TOP = 10;         // worst statements kept
+            static const unsigned RULES = 3;        // rules blamed per region
+
+            // Restores the innermost rule when leaving a rule
+            class scope
+            {
+                heatmap &hm;
+                const Rule *saved;
+
+            public:
+
+                scope(heatmap &h, const Rule *r) : hm(h), saved(h.rule) { hm.rule = r; }
+                ~scope() { hm.rule = saved; }
+            };
+
+        private:
+
+            struct statement
+            {
+                unsigned long long offset, examined, line, length;
+                double amplification;
+                pos_t region;                       // hottest region
+                unsigned region_bytes;
+                unsigned long long region_reads, region_rewinds;
+                std::vector<std::pair<const char *, unsigned long long>> rules;
+            };
+
+            std::vector<unsigned long long> reads, rewinds;                                 // by position in the statement
+            std::map<std::pair<pos_t, const Rule *>, unsigned long long> blame;     // re-reads by region and rule
+            const Rule *rule = nullptr;
+
+            std::vector<statement> worst;
+            unsigned long long statements = 0, length = 0, examined = 0;
+
+            static const char *name(const Rule *r);
+
+        public:
+
+            // A byte is read at pos
+            void read(pos_t pos)
+            {
+                if ( pos >= reads.size() )
+                    reads.resize(pos + 1);
+                if ( reads[pos]++ )
+                    blame[{ pos / REGION, rule }]++;
+            }
+
+            // Input is rewound from pos to mpos
+            void rewind(pos_t mpos, pos_t pos)
+            {
+                if ( pos > rewinds.size() )
+                    rewinds.resize(pos);
+                for ( pos_t p = mpos ; p < pos ; p++ )
+                    rewinds[p]++;
+            }
+
+            // Discard the counts of the current statement
+            void clear()
+            {
+                reads.clear();
+                rewinds.clear();
+                blame.clear();
+            }
+
+            // A statement of len bytes at offset and line is accepted
+            void accept(unsigned long long offset, unsigned long long line, pos_t len)
+            {
+                statement st { offset, 0, line, len, 0, 0, 0, 0, 0, { } };
+
+                for ( pos_t r = 0 ; r * REGION < reads.size() ; r++ )
+                {
+                    unsigned long long rd = 0, rw = 0;
+                    pos_t p;
+                    for ( p = r * REGION ; p < (r + 1) * REGION && p < reads.size() ; p++ )
+                    {
+                        rd += reads[p];
+                        rw += p < rewinds.size() ? rewinds[p] : 0;
+                    }
+                    st.examined += rd;
+                    if ( rd > st.region_reads )
+                    {
+                        st.region = r;
+                        st.region_bytes = p - r * REGION;
+                        st.region_reads = rd;
+                        st.region_rewinds = rw;
+                    }
+                }
+                st.amplification = double(st.examined) / (len ? len : 1);
+
+                statements++;
+                length += len;
+                examined += st.examined;
+
+                if ( worst.size() < TOP || st.amplification > worst.back().amplification )
+                {
+                    // Blame rules for the re-reads in the hottest region
+                    for ( auto iter = blame.lower_bound({ st.region, nullptr }) ; iter != blame.end() && iter->first.first == st.region ; iter++ )
+                        st.rules.emplace_back(name(iter->first.second), iter->second);
+                    std::sort(st.rules.begin(), st.rules.end(), [ ](const auto &a, const auto &b) { return a.second > b.second; });
+                    if ( st.rules.size() > RULES )
+                        st.rules.resize(RULES);
+
+                    auto iter = std::upper_bound(worst.begin(), worst.end(), st, [ ](const statement &a, const statement &b) 
+                    { 
+                        return a.amplification > b.amplification; 
+                    });
+                    worst.insert(iter, st);
+                    if ( worst.size() > TOP )
+                        worst.pop_back();
+                }
+
+                clear();
+            }
+
+            // Print totals and the worst statements
+            void report(std::ostream &os) const
+            {
+                char buf[200];
+
+                std::snprintf(buf, sizeof buf, "%llu statements, %llu bytes accepted, %llu bytes read, amplification %.2f\n",
+                        statements, length, examined, double(examined) / (length ? length : 1));
+                os << buf;
+
+                for ( const auto &st : worst )
+                {
+                    std::snprintf(buf, sizeof buf, "line %llu offset %llu: %llu bytes, %llu read, amplification %.2f\n",
+                            st.line, st.offset, st.length, st.examined, st.amplification);
+                    os << buf;
+
+                    if ( !st.region_bytes )
+                        continue;
+                    unsigned long long start = st.offset + st.region * REGION;
+                    std::snprintf(buf, sizeof buf, "    hottest bytes %llu-%llu: %.2f reads/byte, %llu rewinds; re-read by",
+                            start, start + st.region_bytes - 1, double(st.region_reads) / st.region_bytes, st.region_rewinds);
+                    os << buf;
+                    for ( const auto &[name, count] : st.rules )
+                        os << ' ' << name << " (" << count << ')';
+                    os << '\n';
+                }
+            }
+        };
+#endif
+
        // Lexical matcher, scheduled actions handler, text capture and value stack helper
         class matcher
         {
             // Constants
             static const unsigned BUFLEN = 1024;
+            static const unsigned BULKLEN = 65536;      // input read at once by bulk scans
             static const unsigned ACTSIZE = 32;
             static const unsigned ERRORLEN = 60;
             
@@ -57,7 +271,13 @@ namespace peg
             friend class peg::Rule;
             template <typename T> friend class value_stack;
             friend class parser;
+            friend class profiler;
+            friend class analyzer;
+            friend class compiler;
             template <typename T> friend class peg::Parser;
+#ifdef PEG_TREE
+            friend class peg::Tree;
+#endif
 
             // Types
             class char_class  
@@ -83,6 +303,7 @@ namespace peg
                 std::bitset<NBITS> bs;              // optimization for the first NBITS characters  
                 std::set<char_range> cs;            // for higher characters
                 bool inverted = false;
+                std::bitset<NBITS> raw;             // the class read as bytes, inversion applied
 
                 void add_range(char32_t lo, char32_t hi)
                 {
@@ -111,10 +332,21 @@ namespace peg
 
                 char_class(const std::string &s) 
                 {
+                    // Read s as bytes
+                    for ( std::size_t i = s[0] == '^' ; i < s.length() ; i++ )
+                        if ( i + 2 < s.length() && s[i + 1] == '-' )
+                        {
+                            for ( unsigned c = s[i] & 0xFF ; c <= unsigned(s[i + 2] & 0xFF) ; c++ )
+                                raw.set(c);
+                            i += 2;
+                        }
+                        else
+                            raw.set(s[i] & 0xFF);
+                    if ( !s.empty() && s[0] == '^' )
+                        raw.flip();
+
                     // Convert s to a 32-bit string
-                    struct cvt : std::codecvt<char32_t, char, std::mbstate_t> { };
-                    std::wstring_convert<cvt, char32_t> converter;
-                    std::u32string us = converter.from_bytes(s);
+                    std::u32string us = decode(s);
 
                     const char32_t *p = us.c_str(), *q = p + us.length(); 
          
@@ -146,42 +378,382 @@ namespace peg
                     bool found = value < NBITS ? bs[value] : cs.count(char_range(value, value));
                     return inverted ? !found : found; 
                 }
+
+                bool find_byte(unsigned char b) const { return raw[b]; }
+
+                // The bytes a match of this class may start with in an encoding: for utf8,
+                // any non-ascii character brings in all the non-ascii bytes
+                std::bitset<NBITS> first_bytes(Encoding enc = Encoding::UTF8) const
+                {
+                    if ( enc == Encoding::BYTES )
+                        return raw;
+
+                    std::bitset<NBITS> fb;
+                    if ( enc == Encoding::LATIN1 )
+                    {
+                        for ( unsigned c = 0 ; c < NBITS ; c++ )
+                            fb[c] = find(c);
+                        return fb;
+                    }
+
+                    bool high = inverted || !cs.empty();
+
+                    for ( unsigned c = 0 ; c < NBITS ; c++ )
+                        if ( bs[c] != inverted )
+                        {
+                            if ( c < 0x80 )
+                                fb.set(c);
+                            else
+                                high = true;
+                        }
+                    if ( high )
+                        for ( unsigned c = 0x80 ; c < NBITS ; c++ )
+                            fb.set(c);
+                    return fb;
+                }
+
+                // The characters of this class as sorted, disjoint ranges, up to max, or
+                // its bytes if read as bytes
+                std::vector<std::pair<char32_t, char32_t>> ranges(char32_t max, bool bytes = false) const
+                {
+                    std::vector<std::pair<char32_t, char32_t>> rs;
+                    if ( bytes )
+                    {
+                        for ( unsigned c = 0 ; c < NBITS ; c++ )
+                            if ( raw[c] )
+                            {
+                                if ( !rs.empty() && rs.back().second + 1 == c )
+                                    rs.back().second = c;
+                                else
+                                    rs.emplace_back(c, c);
+                            }
+                        return rs;
+                    }
+
+                    auto add = [&](char32_t lo, char32_t hi)
+                    {
+                        if ( !rs.empty() && rs.back().second + 1 == lo )
+                            rs.back().second = hi;
+                        else
+                            rs.emplace_back(lo, hi);
+                    };
+                    for ( unsigned c = 0 ; c < NBITS ; c++ )
+                        if ( bs[c] )
+                            add(c, c);
+                    for ( const auto &r : cs )
+                        add(r.low, r.high);
+                    if ( !inverted )
+                        return rs;
+
+                    std::vector<std::pair<char32_t, char32_t>> inv;
+                    char32_t next = 0;
+                    for ( const auto &r : rs )
+                    {
+                        if ( r.first > next )
+                            inv.emplace_back(next, r.first - 1);
+                        next = r.second + 1;
+                    }
+                    if ( next <= max )
+                        inv.emplace_back(next, max);
+                    return inv;
+                }
+
+                // Whether every character of c is in this class
+                bool includes(const char_class &c) const
+                {
+                    for ( unsigned i = 0 ; i < NBITS ; i++ )
+                        if ( c.bs[i] != c.inverted && !find(i) )
+                            return false;
+
+                    // Compare the high characters
+                    if ( c.inverted )
+                        return inverted && std::all_of(cs.begin(), cs.end(), [&](const char_range &r) { return c.covers(r); });
+                    return std::all_of(c.cs.begin(), c.cs.end(), [&](const char_range &r) { return inverted ? !cs.count(r) : covers(r); });
+                }
+
+            private:
+
+                // Whether a single range of cs holds all of r
+                bool covers(const char_range &r) const
+                {
+                    auto iter = cs.find(char_range(r.low, r.low));
+                    return iter != cs.end() && iter->low <= r.low && r.high <= iter->high;
+                }
             };
      
-            struct mark { unsigned pos, actpos, begin, end; };
+            // Decode an utf8 string the same way getc32() decodes input.
+            static std::u32string decode(const std::string &s)
+            {
+                std::u32string us;
+                us.reserve(s.length());
+
+                for ( std::size_t i = 0 ; i < s.length() ; )
+                {
+                    char32_t u = s[i++] & 0xFF;
+                    int n;
+
+                    if ( (u & 0xC0) != 0xC0 )       // not an utf8 sequence
+                        n = 0;
+                    else if ( u < 0xE0 )            // 2-byte sequence
+                    {
+                        u &= 0x1F;
+                        n = 1;
+                    }
+                    else if ( u < 0xF0 )            // 3-byte sequence
+                    {
+                        u &= 0x0F;
+                        n = 2;
+                    }
+                    else if ( u < 0xF8 )            // 4-byte sequence
+                    {
+                        u &= 0x07;
+                        n = 3;
+                    }
+                    else
+                        n = 0;
+
+                    while ( n-- && i < s.length() ) // continuation bytes
+                        u = (u << 6) | (s[i++] & 0x3F);
+
+                    us += u;
+                }
+
+                return us;
+            }
+
+            // Brackets and quotes of a balanced group, classified by byte
+            struct bracket_set
+            {
+                enum : unsigned char { PLAIN, OPEN, CLOSE, QUOTE, NEWLINE };
+
+                unsigned char kind[256] = { };
+                char closer[256] = { };     // of each opening bracket
+                char escape;
+
+                bracket_set(const std::string &pairs, const std::string &quotes, char esc) : escape(esc)
+                {
+                    kind[unsigned('\n')] = NEWLINE;
+                    for ( std::size_t i = 0 ; i + 1 < pairs.length() ; i += 2 )
+                    {
+                        kind[pairs[i] & 0xFF] = OPEN;
+                        closer[pairs[i] & 0xFF] = pairs[i + 1];
+                        kind[pairs[i + 1] & 0xFF] = CLOSE;
+                    }
+                    for ( char q : quotes )
+                        kind[q & 0xFF] = QUOTE;
+                }
+            };
+
+            // Bytes a match may start with, for scans
+            struct byte_set
+            {
+                bool has[256] = { };
+                int only = -1;              // the only byte in the set, if just one
+
+                byte_set(const std::bitset<256> &b)
+                {
+                    for ( unsigned i = 0 ; i < 256 ; i++ )
+                        if ( (has[i] = b[i]) && b.count() == 1 )
+                            only = i;
+                }
+            };
+
+            // An Aho-Corasick automaton finding where literals occur, for scans
+            struct literal_set
+            {
+                unsigned char cls[256] = { };   // byte classes, 0 for bytes in no literal
+                unsigned nclasses = 1;
+                std::vector<unsigned> delta;    // next state by state and class
+                std::vector<unsigned> depth;    // length of the text a state stands for
+                std::vector<unsigned> out;      // length of the longest literal ending at a state
+                std::size_t maxlen = 0;
+
+                literal_set(const std::vector<std::string> &lits)
+                {
+                    for ( const auto &l : lits )
+                    {
+                        for ( char c : l )
+                            if ( !cls[c & 0xFF] )
+                                cls[c & 0xFF] = nclasses++;
+                        maxlen = std::max(maxlen, l.length());
+                    }
+
+                    // A trie of the literals, state 0 being the root
+                    unsigned k = nclasses;
+                    delta.assign(k, 0);
+                    depth.assign(1, 0);
+                    out.assign(1, 0);
+                    for ( const auto &l : lits )
+                    {
+                        unsigned n = 0;
+                        for ( char c : l )
+                        {
+                            unsigned e = n * k + cls[c & 0xFF];
+                            if ( !delta[e] )
+                            {
+                                delta[e] = depth.size();
+                                depth.push_back(depth[n] + 1);
+                                out.push_back(0);
+                                delta.resize(delta.size() + k, 0);
+                            }
+                            n = delta[e];
+                        }
+                        out[n] = l.length();
+                    }
+
+                    // Failure links, breadth first, turned into transitions
+                    std::vector<unsigned> fail(depth.size(), 0), queue;
+                    for ( unsigned c = 0 ; c < k ; c++ )
+                        if ( delta[c] )
+                            queue.push_back(delta[c]);
+                    for ( std::size_t i = 0 ; i < queue.size() ; i++ )
+                    {
+                        unsigned n = queue[i];
+                        out[n] = std::max(out[n], out[fail[n]]);
+                        for ( unsigned c = 0 ; c < k ; c++ )
+                        {
+                            unsigned &d = delta[n * k + c];
+                            if ( d )
+                            {
+                                fail[d] = delta[fail[n] * k + c];
+                                queue.push_back(d);
+                            }
+                            else
+                                d = delta[fail[n] * k + c];
+                        }
+                    }
+                }
+            };
+
+            // The literals of a choice in a trie, with the alternatives ending at each node
+            struct literal_trie
+            {
+                static const unsigned MAXPATH = 32;     // alternatives ending on a path from the root
+
+                struct node
+                {
+                    unsigned char lo = 1, hi = 0;       // children by byte, in next[base + c - lo]
+                    unsigned base = 0;
+                    unsigned ends = 0, nends = 0;       // alternatives in ends[]
+                };
+
+                std::vector<node> nodes;
+                std::vector<unsigned> next, ends;
+                bool valid = true;                      // no path ends more than MAXPATH alternatives
+
+                literal_trie(const std::vector<std::string> &lits)
+                {
+                    std::vector<std::map<unsigned char, unsigned>> kids(1);
+                    std::vector<std::vector<unsigned>> at(1);
+                    for ( unsigned i = 0 ; i < lits.size() ; i++ )
+                    {
+                        unsigned n = 0;
+                        for ( char c : lits[i] )
+                        {
+                            auto iter = kids[n].find(c);
+                            if ( iter != kids[n].end() )
+                            {
+                                n = iter->second;
+                                continue;
+                            }
+                            kids[n].emplace(c, kids.size());
+                            kids.emplace_back();
+                            at.emplace_back();
+                            n = kids.size() - 1;
+                        }
+                        at[n].push_back(i);
+                    }
+
+                    // Children in ranges of bytes. Children come after their parents.
+                    std::vector<unsigned> path(kids.size());     // alternatives ending on the path to a node
+                    path[0] = at[0].size();
+                    nodes.resize(kids.size());
+                    for ( unsigned n = 0 ; n < kids.size() ; n++ )
+                    {
+                        node &nd = nodes[n];
+                        valid = valid && path[n] <= MAXPATH;
+                        for ( auto [c, k] : kids[n] )
+                            path[k] = path[n] + at[k].size();
+                        if ( !kids[n].empty() )
+                        {
+                            nd.lo = kids[n].begin()->first;
+                            nd.hi = kids[n].rbegin()->first;
+                            nd.base = next.size();
+                            next.resize(next.size() + nd.hi - nd.lo + 1, 0);
+                            for ( auto [c, k] : kids[n] )
+                                next[nd.base + c - nd.lo] = k;
+                        }
+                        nd.ends = ends.size();
+                        nd.nends = at[n].size();
+                        ends.insert(ends.end(), at[n].begin(), at[n].end());
+                    }
+                }
+            };
+
+            // A DFA over bytes, for compiled regular expressions. State 0 is stuck, 1 
+            // is the start.
+            struct dfa
+            {
+                unsigned char cls[256] = { };   // byte classes
+                unsigned nclasses = 0;
+                std::vector<unsigned> delta;    // next state by state and class
+                std::vector<char> accept;
+            };
+
+#ifdef PEG_TREE
+            struct mark { pos_t pos; unsigned actpos; pos_t begin, end; std::size_t nodepos; };
+
+            // A node of the syntax tree, for a rule that succeeded. Nodes are kept in 
+            // preorder, each followed by the size nodes below it.
+            struct tree_node
+            {
+                const Rule *rule;
+                pos_t begin, end;
+                unsigned size, children;
+            };
+#else
+            struct mark { pos_t pos; unsigned actpos; pos_t begin, end; };
+#endif
      
             struct action
             {
-                std::function<void()> func;
-                unsigned begin, end, base;
+                const std::function<void()> *func;     // of the Do() expression, not copied
+                pos_t begin, end;
+                unsigned base;
             };
 
             // Memo key
             struct memo_key
             {
                 uintptr_t rule;
-                unsigned pos;
+                pos_t pos;
                 unsigned base;
                 unsigned in_lah;
                 
-                bool operator<(const memo_key &other) const 
+                bool operator==(const memo_key &other) const 
                 { 
-                    if ( rule != other.rule )
-                        return rule < other.rule;
-                    if ( pos != other.pos )
-                        return pos < other.pos;
-                    if ( base != other.base )
-                        return base < other.base;
-                    return !in_lah && other.in_lah; 
+                    return rule == other.rule && pos == other.pos && base == other.base && !in_lah == !other.in_lah;
+                }
+
+                std::size_t hash() const
+                {
+                    std::size_t h = (rule >> 4) * 0x9E3779B97F4A7C15ull ^ pos * 0xC2B2AE3D27D4EB4Full ^ base * 0x165667B19E3779F9ull ^ !in_lah;
+                    return h ^ h >> 29;
                 }
             };
 
             // Memo state
             struct memo_state
             {
+                std::size_t slot;       // in the memo table
                 bool found, result;
-                unsigned pos, cap_begin, cap_end, actpos;
+                pos_t pos, cap_begin, cap_end;
+                unsigned actpos;
                 std::vector<action> actions;
+#ifdef PEG_TREE
+                std::size_t nodepos;
+                std::vector<tree_node> nodes;
+#endif
                 
                 virtual ~memo_state() = default;
                 virtual void save_extra() { }
@@ -191,55 +763,105 @@ namespace peg
             // Properties
             std::istream &in;
             std::string ibuf;
-            char *buf = new char[BUFLEN];
-            unsigned pos = 0;
+            bool in_memory = false;         // ibuf holds all the input, set by set_input()
+            pos_t pos = 0;
+            unsigned long long offset = 0;  // input offset of ibuf[0]
 
-            unsigned cap_begin = 0;
-            unsigned cap_end = 0;
+            pos_t cap_begin = 0;
+            pos_t cap_end = 0;
 
             vect<action> actions;
             unsigned actpos = 0;
 
-            std::set<unsigned> lines;
-            unsigned prev_lines = 0;
+#ifdef PEG_TREE
+            bool tree = false;                  // build a syntax tree
+            std::vector<tree_node> nodes;
+#endif
+
+            std::set<pos_t> lines;
+            unsigned long long prev_lines = 0;     // lines before ibuf[0]
 
             unsigned level = 0;
             unsigned base = 0;
 
-            unsigned error_pos = 0;
+            pos_t error_pos = 0;
             std::string error_info;
             unsigned in_lah = 0;
 
-            std::map<memo_key, memo_state *> memo;
+            unsigned depth = 0;                 // rules being parsed
+            unsigned max_depth = ~0u;           // no limit unless set
+            bool too_deep = false;              // rules nested deeper than max_depth, failing the parse
+
+            Encoding enc = Encoding::UTF8;      // how input bytes make characters
+
+#ifdef PEG_PROFILE
+            pos_t furthest = 0;         // furthest position read, for profiling
+#endif
+
+#ifdef PEG_TRACE
+            Tracer *tracer = nullptr;   // tracer of the current parse, if any
+#endif
+
+#ifdef PEG_HEATMAP
+            heatmap heat;
+#endif
+
+            // Memo table, open addressed in a power of 2 slots, and its states. Clearing
+            // it keeps the slots and the states (with their action logs) for reuse.
+            struct memo_slot
+            {
+                memo_key key;
+                memo_state *state;              // null if free
+            };
+            std::vector<memo_slot> memo;
+            std::vector<std::unique_ptr<memo_state>> memo_states;
+            std::size_t memo_used = 0;          // states in use
 
             // These are overridden by use_vs() for parsers with value stack
             std::function<memo_state *()> memo_alloc = [ ] { return new memo_state; };
             bool use_base = false;
 
            // Construct from an std::istream, default is std::cin.
-            matcher(std::istream &is = std::cin) : in(is) { actions.reserve(ACTSIZE); }
-            ~matcher() { delete[] buf; memo_clear(); }
+           // Nothing is allocated until parsing starts.
+            matcher(std::istream &is = std::cin) : in(is) { }
             matcher(const matcher &) = delete;                  // not copyable
             matcher &operator=(const matcher &) = delete;       // not assignable
 
+            // Append up to n bytes of input to the buffer, none for input in memory
+            bool fill(std::size_t n = BUFLEN)
+            {
+                if ( in_memory )
+                    return false;
+                std::size_t len = ibuf.length();
+                ibuf.resize(len + n);
+                in.read(&ibuf[len], n);
+                std::streamsize r = in.gcount();
+                ibuf.resize(len + (r > 0 ? r : 0));
+                return r > 0;
+            }
+
             // Read a raw char from input.
             bool getc(char &c) 
             {
-                if ( pos == ibuf.length() )     // try to get more input
-                {
-                    in.read(buf, BUFLEN);
-                    int n = in.gcount();
-                    if ( n <= 0 )
-                        return false;
-                    ibuf.append(buf, n);
-                }
+                if ( pos == ibuf.length() && !fill() )     // try to get more input
+                    return false;
 
+#ifdef PEG_STATS
+                stats.bytes++;
+#endif
+#ifdef PEG_PROFILE
+                if ( pos >= furthest )
+                    furthest = pos + 1;
+#endif
+#ifdef PEG_HEATMAP
+                heat.read(pos);
+#endif
                 if ( (c = ibuf[pos++]) == '\n' )
                     lines.insert(pos);
                 return true;
             }
 
-            // Read a 32-bit char from input.
+            // Read a 32-bit char from input, an utf8 sequence or a byte by the encoding.
             // Assumes (and does not check) correct utf8 encoding.
             bool getc32(char32_t &u)
             {
@@ -251,7 +873,7 @@ namespace peg
 
                 u = c & 0xFF;
 
-                if ( (c & 0xC0) != 0xC0 )   // not an utf8 sequence
+                if ( (c & 0xC0) != 0xC0 || enc != Encoding::UTF8 )   // not an utf8 sequence
                     return true;
 
                 // Decode first byte of sequence
@@ -293,15 +915,27 @@ namespace peg
 
             // Matching primitives
 
-            bool match_any() { char32_t c; return getc32(c); }
+            bool match_any() 
+            { 
+                char32_t c; 
+                pos_t mpos = pos;
+
+                if ( !getc32(c) )           // a sequence cut short by the end of input
+                {
+                    pos = mpos;
+                    return false;
+                }
+
+                return true;
+            }
 
             bool match_string(const std::string &s)
             {
                 char c;
-                unsigned len = s.length();
-                unsigned mpos = pos;
+                size_t len = s.length();
+                pos_t mpos = pos;
 
-                for ( unsigned i = 0 ; i < len ; i++ )
+                for ( size_t i = 0 ; i < len ; i++ )
                     if ( !getc(c) || c != s[i] )
                     {
                         pos = mpos;
@@ -314,7 +948,7 @@ namespace peg
             bool match_char(char32_t ch)
             {
                 char32_t u;
-                unsigned mpos = pos;
+                pos_t mpos = pos;
 
                 if ( !getc32(u) || u != ch )
                 {
@@ -328,9 +962,9 @@ namespace peg
             bool match_class(const char_class &ccl)
             {
                 char32_t u;
-                unsigned mpos = pos;
+                pos_t mpos = pos;
      
-                if ( !getc32(u) || !ccl.find(u) )
+                if ( !getc32(u) || !(enc == Encoding::BYTES ? ccl.find_byte(u) : ccl.find(u)) )
                 {
                     pos = mpos;
                     return false;
@@ -339,47 +973,376 @@ namespace peg
                 return true;
             }
 
-            // Schedule an action
-            void schedule(std::function<void()> f)
+            // Follow input down a trie as far as it goes, recording the nodes where 
+            // literals end with the positions after them. Returns their number.
+            unsigned match_trie(const literal_trie &t, std::pair<unsigned, pos_t> *found)
             {
-                if ( in_lah )
-                    return;
+                unsigned n = 0, k = 0;
+                char c;
 
-                action &act = actions[actpos++];
-                act.func = f;
-                act.begin = cap_begin;
-                act.end = cap_end;
-                act.base = base;
-            }
+                for ( ;; )
+                {
+                    const literal_trie::node &nd = t.nodes[n];
+                    if ( nd.nends )
+                        found[k++] = { n, pos };
+                    if ( nd.lo > nd.hi || !getc(c) )
+                        break;
+                    unsigned char u = c;
+                    if ( u < nd.lo || u > nd.hi || !(n = t.next[nd.base + u - nd.lo]) )
+                        break;
+                }
 
-            // Set a mark and backtrack to it
-            void set_mark(mark &mk) const { mk.pos = pos; mk.actpos = actpos; mk.begin = cap_begin; mk.end = cap_end; }
-            void go_mark(const mark &mk) { pos = mk.pos; actpos = mk.actpos; cap_begin = mk.begin; cap_end = mk.end; }
+                return k;
+            }
 
-            // Handle indices for automatic value stacks
-            unsigned get_level() const { return level; }
-            void set_level(unsigned n) { level = n; }
+            // Run a DFA as far as input takes it, and match up to the last accepting state
+            bool match_dfa(const dfa &d)
+            {
+                const pos_t NONE = ~pos_t(0);
+                pos_t i = pos, last = d.accept[1] ? pos : NONE, s = 1;
 
-            unsigned get_base() const { return base; }
-            void set_base(unsigned n) { if ( use_base ) base = n; }
+                while ( i < ibuf.length() || fill() )
+                {
+                    unsigned char c = ibuf[i++];
+                    if ( c == '\n' )
+                        lines.insert(lines.end(), i);
+                    if ( !(s = d.delta[s * d.nclasses + d.cls[c]]) )
+                        break;
+                    if ( d.accept[s] )
+                        last = i;
+                }
 
-            // Capture text
-            unsigned begin_capture() const { return pos; }
-            void end_capture(unsigned b) { cap_begin = b; cap_end = pos; }
+                read_bulk(pos, i);
+                if ( last == NONE )
+                    return false;
+                pos = last;
+                return true;
+            }
 
-            // Increase/decrease lookahead level
-            void begin_lah() { in_lah++; }
-            void end_lah() { in_lah--; }
+            // Account for the bytes from p to q, read in bulk
+            void read_bulk(pos_t p, pos_t q)
+            {
+#ifdef PEG_STATS
+                stats.bytes += q - p;
+#endif
+#ifdef PEG_PROFILE
+                if ( q > furthest )
+                    furthest = q;
+#endif
+#ifdef PEG_HEATMAP
+                for ( ; p < q ; p++ )
+                    heat.read(p);
+#endif
+            }
 
-            // Set state allocator and enable use of base for parsers with value stack
-            void use_vs(const std::function<memo_state *()> &alloc) { memo_alloc = alloc; use_base = true; }
+            // Match an opening bracket and everything up to its closing bracket, skipping
+            // quoted strings, in a tight loop over buffered input. Closing brackets must
+            // match, strings must end.
+            bool match_balanced(const bracket_set &bs)
+            {
+                pos_t mpos = pos;
+                char c;
 
-            // Find a previously saved state or create a new one.
+                if ( !getc(c) || bs.kind[c & 0xFF] != bracket_set::OPEN )
+                {
+                    pos = mpos;
+                    return false;
+                }
+
+                std::string closers(1, bs.closer[c & 0xFF]);
+                char quote = 0;
+                bool escaped = false;
+
+                while ( pos < ibuf.length() || fill(BULKLEN) )
+                {
+                    const char *b = ibuf.data();
+                    pos_t i = pos, n = ibuf.length();
+
+                    while ( i < n && !closers.empty() )
+                    {
+                        unsigned char u = b[i++];
+
+                        if ( u == '\n' )
+                            lines.insert(lines.end(), i);
+                        if ( quote )
+                        {
+                            if ( escaped )
+                                escaped = false;
+                            else if ( u == quote )
+                                quote = 0;
+                            else if ( u == bs.escape )
+                                escaped = true;
+                            continue;
+                        }
+
+                        switch ( bs.kind[u] )
+                        {
+                            case bracket_set::OPEN:
+                                closers += bs.closer[u];
+                                break;
+                            case bracket_set::CLOSE:
+                                if ( closers.back() != char(u) )
+                                {
+                                    read_bulk(pos, i);
+                                    pos = mpos;
+                                    return false;
+                                }
+                                closers.pop_back();
+                                break;
+                            case bracket_set::QUOTE:
+                                quote = u;
+                                break;
+                        }
+                    }
+
+                    read_bulk(pos, i);
+                    pos = i;
+                    if ( closers.empty() )
+                        return true;
+                }
+
+                pos = mpos;
+                return false;
+            }
+
+            // Pass the first n bytes of input to f and consume them, between statements
+            void skip(std::size_t n, const std::function<void(std::string_view)> &f)
+            {
+#ifdef PEG_STATS
+                stats.bytes += n;
+#endif
+                f(std::string_view(ibuf.data(), n));
+                prev_lines += std::count(ibuf.begin(), ibuf.begin() + n, '\n');
+                ibuf.erase(0, n);
+                offset += n;
+            }
+
+            // Consume input up to the next byte in bs, passing it to f in pieces, with
+            // memchr if bs has a single byte. False if input ends first.
+            bool skip_until(const byte_set &bs, const std::function<void(std::string_view)> &f)
+            {
+                for ( ;; )
+                {
+                    if ( ibuf.empty() && !fill() )
+                        return false;
+
+                    const char *b = ibuf.data(), *e = b + ibuf.length(), *p = e;
+                    if ( bs.only >= 0 )
+                    {
+                        if ( const void *q = std::memchr(b, bs.only, e - b) )
+                            p = static_cast<const char *>(q);
+                    }
+                    else
+                        for ( p = b ; p < e && !bs.has[*p & 0xFF] ; p++ )
+                            ;
+
+                    if ( p > b )
+                        skip(p - b, f);
+                    if ( p < e )
+                        return true;
+                }
+            }
+
+            // Consume input up to the leftmost occurrence of a literal of ls, passing it
+            // to f in pieces. False if input ends first.
+            bool skip_until(const literal_set &ls, const std::function<void(std::string_view)> &f)
+            {
+                const std::size_t NONE = std::string::npos;
+                std::size_t i = 0, start = NONE;
+                unsigned s = 0, k = ls.nclasses;
+
+                for ( ;; )
+                {
+                    const char *b = ibuf.data();
+                    std::size_t n = ibuf.length();
+                    for ( ; i < n && (start == NONE || i < start + ls.maxlen) ; i++ )
+                    {
+                        s = ls.delta[s * k + ls.cls[b[i] & 0xFF]];
+                        if ( ls.out[s] )
+                            start = std::min(start, i + 1 - ls.out[s]);
+                    }
+                    if ( start != NONE && i == start + ls.maxlen )
+                        break;
+
+                    // Nothing found starts before the text the state stands for
+                    if ( start == NONE && i > ls.depth[s] )
+                    {
+                        skip(i - ls.depth[s], f);
+                        i = ls.depth[s];
+                    }
+                    if ( !fill() )
+                        break;
+                }
+
+                if ( start == NONE )
+                {
+                    if ( !ibuf.empty() )
+                        skip(ibuf.length(), f);
+                    return false;
+                }
+                if ( start )
+                    skip(start, f);
+                return true;
+            }
+
+            // Discard the last parse, failed or empty, and pass the char at the start of 
+            // input to f
+            void reject(const std::function<void(std::string_view)> &f)
+            {
+                actpos = 0;
+#ifdef PEG_TREE
+                nodes.clear();
+#endif
+                pos = 0;
+#ifdef PEG_PROFILE
+                furthest = 0;
+#endif
+                cap_begin = cap_end = 0;
+                base = level = 0;
+                lines.clear();
+                error_pos = 0;
+                error_info = "";
+                in_lah = 0;
+                memo_clear();
+
+                // A character, as getc32() reads it
+                unsigned char c = ibuf[0];
+                std::size_t n = enc != Encoding::UTF8 || c < 0xC0 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : c < 0xF8 ? 4 : 1;
+                while ( ibuf.length() < n && fill() )
+                    ;
+                n = std::min(n, ibuf.length());
+
+#ifdef PEG_HEATMAP
+                heat.accept(offset, prev_lines + 1, n);
+#endif
+                skip(n, f);
+            }
+
+            // Schedule an action
+            void schedule(const std::function<void()> &f)
+            {
+                if ( in_lah )
+                    return;
+
+                action &act = actions[actpos++];
+                act.func = &f;
+                act.begin = cap_begin;
+                act.end = cap_end;
+                act.base = base;
+            }
+
+            // Reserve space for actions before the first parse
+            void reserve() 
+            { 
+                if ( !actions.capacity() ) 
+                    actions.reserve(ACTSIZE); 
+            }
+
+            // Enter a rule, or fail the parse if rules are nested too deep
+            bool enter()
+            {
+                if ( depth < max_depth && !too_deep )
+                {
+                    depth++;
+                    return true;
+                }
+                if ( !too_deep )
+                {
+                    too_deep = true;
+                    error_pos = pos;
+                }
+                return false;
+            }
+
+            // Leaves the rule entered when destroyed, also if its parse throws
+            class depth_scope
+            {
+                matcher &m;
+
+            public:
+
+                depth_scope(matcher &m) : m(m) { }
+                ~depth_scope() { m.depth--; }
+            };
+
+            // Set a mark and backtrack to it
+            void set_mark(mark &mk) const 
+            { 
+                mk.pos = pos; mk.actpos = actpos; mk.begin = cap_begin; mk.end = cap_end; 
+#ifdef PEG_TREE
+                mk.nodepos = nodes.size();
+#endif
+            }
+            void go_mark(const mark &mk) 
+            { 
+#ifdef PEG_STATS
+                stats.backtracks++;
+#endif
+#ifdef PEG_HEATMAP
+                heat.rewind(mk.pos, pos);
+#endif
+                pos = mk.pos; actpos = mk.actpos; cap_begin = mk.begin; cap_end = mk.end; 
+#ifdef PEG_TREE
+                if ( nodes.size() > mk.nodepos )
+                    nodes.resize(mk.nodepos);
+#endif
+            }
+
+#ifdef PEG_TREE
+            // Open a tree node for rule r, and close it when r is done: a failed rule
+            // leaves no nodes
+            std::size_t open_node(const Rule *r)
+            {
+                nodes.push_back({ r, pos, pos, 0, 0 });
+                return nodes.size() - 1;
+            }
+            void close_node(std::size_t at, bool r)
+            {
+                if ( !r )
+                {
+                    nodes.resize(at);
+                    return;
+                }
+                tree_node &nd = nodes[at];
+                nd.end = pos;
+                nd.size = nodes.size() - at - 1;
+                for ( std::size_t i = at + 1 ; i < nodes.size() ; i += nodes[i].size + 1 )
+                    nd.children++;
+            }
+#endif
+
+            // Handle indices for automatic value stacks
+            unsigned get_level() const { return level; }
+            void set_level(unsigned n) { level = n; }
+
+            unsigned get_base() const { return base; }
+            void set_base(unsigned n) { if ( use_base ) base = n; }
+
+            // Input offset of the current position
+            unsigned long long position() const { return offset + pos; }
+
+            // Capture text
+            pos_t begin_capture() const { return pos; }
+            void end_capture(pos_t b) { cap_begin = b; cap_end = pos; }
+
+            // Increase/decrease lookahead level
+            void begin_lah() { in_lah++; }
+            void end_lah() { in_lah--; }
+
+            // Set state allocator and enable use of base for parsers with value stack
+            void use_vs(const std::function<memo_state *()> &alloc) { memo_alloc = alloc; use_base = true; }
+
+            // Find a previously saved state or create a new one.
             // If found, restore next state. Otherwise create a new state to be saved after successful parsing.
             memo_state *memo_lookup(const Rule *rule)
             {
                 memo_key key { reinterpret_cast<uintptr_t>(rule), pos, base, in_lah };
-                memo_state *ptr = memo[key];
+                if ( (memo_used + 1) * 2 > memo.size() )
+                    memo_grow();
+                std::size_t mask = memo.size() - 1, i = key.hash() & mask;
+                while ( memo[i].state && !(memo[i].key == key) )
+                    i = (i + 1) & mask;
+                memo_state *ptr = memo[i].state;
 
                 if ( ptr )
                 {
@@ -391,14 +1354,30 @@ namespace peg
                         cap_end = ptr->cap_end;
                         for ( const auto &a : ptr->actions )
                             actions[actpos++] = a;
+#ifdef PEG_TREE
+                        if ( tree )
+                            nodes.insert(nodes.end(), ptr->nodes.begin(), ptr->nodes.end());
+#endif
                         ptr->restore_extra();
                     }
                 } 
                 else 
                 {
-                    memo[key] = ptr = memo_alloc(); 
+                    if ( memo_used == memo_states.size() )
+                        memo_states.emplace_back(memo_alloc());
+                    ptr = memo_states[memo_used++].get();
+                    memo[i] = { key, ptr };
+                    ptr->slot = i;
                     ptr->found = false;
                     ptr->actpos = actpos;
+#ifdef PEG_TREE
+                    ptr->nodepos = nodes.size();
+#endif
+#ifdef PEG_STATS
+                    stats.memo++;
+                    if ( memo_used > stats.memo_peak )
+                        stats.memo_peak = memo_used;
+#endif
                 }
 
                 return ptr;
@@ -412,15 +1391,43 @@ namespace peg
                 ptr->cap_end = cap_end;
                 for ( unsigned i = ptr->actpos ; i < actpos ; i++ )
                     ptr->actions.push_back(actions[i]);
+#ifdef PEG_TREE
+                if ( tree )
+                    ptr->nodes.assign(nodes.begin() + ptr->nodepos, nodes.end());
+#endif
                 ptr->save_extra();
             } 
 
-            // Clear memoized data
+            // Double the memo table, or make its first slots
+            void memo_grow()
+            {
+                std::vector<memo_slot> old(std::max<std::size_t>(memo.size() * 2, 64), memo_slot { });
+                old.swap(memo);
+                std::size_t mask = memo.size() - 1;
+                for ( const auto &s : old )
+                    if ( s.state )
+                    {
+                        std::size_t i = s.key.hash() & mask;
+                        while ( memo[i].state )
+                            i = (i + 1) & mask;
+                        memo[i] = s;
+                        s.state->slot = i;
+                    }
+            }
+
+            // Clear memoized data, keeping the table and states for reuse
             void memo_clear()
             {
-                for ( auto &[key, ptr] : memo )
-                    delete ptr;
-                memo.clear();
+                for ( std::size_t i = 0 ; i < memo_used ; i++ )
+                {
+                    memo_state &st = *memo_states[i];
+                    memo[st.slot].state = nullptr;
+                    st.actions.clear();
+#ifdef PEG_TREE
+                    st.nodes.clear();
+#endif
+                }
+                memo_used = 0;
             }
 
             // Execute scheduled actions and consume matched input, clear memo
@@ -432,18 +1439,29 @@ namespace peg
                     cap_begin = act.begin;
                     cap_end = act.end;
                     base = act.base;
-                    act.func();
+                    (*act.func)();
                 }
      
                 actpos = 0;
+#ifdef PEG_TREE
+                nodes.clear();
+#endif
+
+#ifdef PEG_HEATMAP
+                heat.accept(offset, prev_lines + 1, pos);
+#endif
 
+                prev_lines += std::distance(lines.begin(), lines.upper_bound(pos));   // lines read beyond pos are read again
                 ibuf.erase(0, pos); 
+                offset += pos;
                 pos = 0; 
+#ifdef PEG_PROFILE
+                furthest = 0;
+#endif
 
                 cap_begin = cap_end = 0;
                 base = level = 0;
 
-                prev_lines += lines.size();
                 lines.clear();
                 error_pos = 0;
                 error_info = "";
@@ -456,9 +1474,20 @@ namespace peg
             void clear() 
             { 
                 actpos = 0;
+#ifdef PEG_TREE
+                nodes.clear();
+#endif
+
+#ifdef PEG_HEATMAP
+                heat.clear();
+#endif
 
                 ibuf = "";
+                offset = 0;
                 pos = 0;
+#ifdef PEG_PROFILE
+                furthest = 0;
+#endif
 
                 cap_begin = cap_end = 0;
                 base = level = 0;
@@ -468,17 +1497,30 @@ namespace peg
                 error_pos = 0;
                 error_info = "";
                 in_lah = 0;
+                in_memory = false;
 
                 memo_clear();
             }
 
+            // Discard everything and take s as all the input, instead of reading the 
+            // stream. The buffer keeps its capacity, so short inputs do not allocate.
+            void set_input(std::string_view s)
+            {
+                clear();
+                ibuf.assign(s.data(), s.length());
+                in_memory = true;
+            }
+
             // Get last captured text
             std::string text() const { return ibuf.substr(cap_begin, cap_end - cap_begin); }
 
+            // Get last captured text without copying it, valid until the end of the action
+            std::string_view text_view() const { return std::string_view(ibuf).substr(cap_begin, cap_end - cap_begin); }
+
             // Set error info
             void set_error(const char *error) 
             { 
-                if ( in_lah || pos < error_pos )
+                if ( in_lah || pos < error_pos || too_deep )
                     return;
 
                 if ( pos  > error_pos )
@@ -494,8 +1536,8 @@ namespace peg
             // Get error info
             std::string get_error() const
             { 
-                unsigned line = prev_lines + 1;
-                unsigned nlines = lines.size();
+                unsigned long long line = prev_lines + 1;
+                std::size_t nlines = lines.size();
                 if ( nlines )
                     for ( auto iter = lines.rbegin() ; nlines ; iter++, nlines-- )
                         if ( *iter <= error_pos )
@@ -505,7 +1547,12 @@ namespace peg
                         }
 
                 char buf[200];
-                std::sprintf(buf,"Line %u\nExpecting ", line);
+                if ( too_deep )
+                {
+                    std::sprintf(buf,"Line %llu\nNesting deeper than %u rules", line, max_depth);
+                    return buf + ("\nFound " + ibuf.substr(error_pos, ERRORLEN)) + '\n';
+                }
+                std::sprintf(buf,"Line %llu\nExpecting ", line);
                 return buf + error_info + "\nFound " + ibuf.substr(error_pos, ERRORLEN) + '\n';
             }
          };
@@ -518,12 +1565,236 @@ namespace peg
 
             const matcher &mt;
             vect<T> values;
+            std::size_t capacity;
 
         public:
 
-            value_stack(const matcher &m, std::size_t capacity = VALSIZE) : mt(m) { values.reserve(capacity); }
+            value_stack(const matcher &m, std::size_t capacity = VALSIZE) : mt(m), capacity(capacity) { }
             T &operator[](std::size_t idx) { return values[mt.get_base() + idx]; }
+
+            // Reserve capacity before the first parse
+            void reserve() 
+            { 
+                if ( !values.capacity() ) 
+                    values.reserve(capacity); 
+            }
+        };
+
+#ifdef PEG_PROFILE
+        // Per rule profiler.
+        // Counts are kept for the whole process and are not synchronized, 
+        // so profile parsers running in a single thread.
+        class profiler
+        {
+        public:
+
+            // Measured quantities
+            enum { TIME, CYCLES, CACHE_MISSES, NCOUNTERS };
+            using counters = unsigned long long[NCOUNTERS];
+
+            // Statistics for a rule
+            struct record
+            {
+                const char *name;
+                const void *rule;
+                unsigned long long calls = 0, successes = 0, failures = 0;
+                unsigned long long consumed = 0, discarded = 0;
+                unsigned long long memo_hits = 0, memo_misses = 0;
+                counters inclusive = { }, exclusive = { };
+                unsigned active = 0;                // activations in progress, for recursive rules
+
+                record(const char *n, const void *r) : name(n), rule(r) { }
+            };
+
+        private:
+
+            // An active rule invocation
+            struct frame
+            {
+                record *rec;
+                pos_t pos, furthest;
+                counters start, children;
+            };
+
+            std::vector<std::unique_ptr<record>> records;
+            std::vector<frame> frames;
+            bool perf = false;
+
+#ifdef PEG_PROFILE_PERF
+            int perf_fd = -1;
+
+            // Open a group counting cycles and cache misses of this thread
+            void perf_open()
+            {
+                unsigned long long configs[] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES };
+
+                for ( auto config : configs )
+                {
+                    perf_event_attr attr { };
+                    attr.size = sizeof attr;
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = config;
+                    attr.read_format = PERF_FORMAT_GROUP;
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+
+                    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, perf_fd, 0);
+                    if ( fd < 0 )
+                        return;
+                    if ( perf_fd < 0 )
+                        perf_fd = fd;
+                }
+
+                perf = true;
+            }
+#endif
+
+            profiler() 
+            { 
+#ifdef PEG_PROFILE_PERF
+                perf_open();
+#endif
+            }
+
+            // Read the current counter values
+            void snapshot(counters &c) const
+            {
+                c[TIME] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+                c[CYCLES] = c[CACHE_MISSES] = 0;
+#ifdef PEG_PROFILE_PERF
+                struct { unsigned long long n, values[2]; } data;
+                if ( perf && read(perf_fd, &data, sizeof data) == sizeof data )
+                {
+                    c[CYCLES] = data.values[0];
+                    c[CACHE_MISSES] = data.values[1];
+                }
+#endif
+            }
+
+        public:
+
+            static profiler &get() 
+            { 
+                static profiler p; 
+                return p; 
+            }
+
+            // Create the record of a rule
+            record *add(const char *name, const void *rule)
+            {
+                records.emplace_back(new record(name, rule));
+                return records.back().get();
+            }
+
+            // Rule invocation starts at pos
+            void enter(record *rec, matcher &m)
+            {
+                frames.push_back(frame{ rec, m.pos, m.furthest, { }, { } });
+                m.furthest = m.pos;
+                rec->calls++;
+                rec->active++;
+                snapshot(frames.back().start);
+            }
+
+            // Rule invocation ends with result r
+            void exit(matcher &m, bool r)
+            {
+                counters now;
+                snapshot(now);
+
+                frame &f = frames.back();
+                record *rec = f.rec;
+                pos_t consumed = r ? m.pos - f.pos : 0;
+                pos_t scanned = m.furthest > f.pos ? m.furthest - f.pos : 0;
+
+                if ( r )
+                    rec->successes++;
+                else
+                    rec->failures++;
+                rec->consumed += consumed;
+                rec->discarded += scanned > consumed ? scanned - consumed : 0;
+
+                rec->active--;
+                for ( unsigned i = 0 ; i < NCOUNTERS ; i++ )
+                {
+                    unsigned long long inclusive = now[i] - f.start[i];
+                    if ( !rec->active )             // do not count recursive calls twice
+                        rec->inclusive[i] += inclusive;
+                    rec->exclusive[i] += inclusive - f.children[i];
+                    if ( frames.size() > 1 )
+                        frames[frames.size() - 2].children[i] += inclusive;
+                }
+
+                if ( f.furthest > m.furthest )
+                    m.furthest = f.furthest;
+                frames.pop_back();
+            }
+
+            // Forget an invocation left by an exception
+            void unwind(std::size_t depth)
+            {
+                while ( frames.size() > depth )
+                {
+                    frames.back().rec->active--;
+                    frames.pop_back();
+                }
+            }
+
+            std::size_t depth() const { return frames.size(); }
+
+            // Clear all statistics
+            void reset()
+            {
+                for ( auto &rec : records )
+                    *rec = record(rec->name, rec->rule);
+            }
+
+            // Print the statistics, most expensive rules first
+            void report(std::ostream &os) const
+            {
+                std::vector<const record *> sorted;
+                for ( const auto &rec : records )
+                    if ( rec->calls )
+                        sorted.push_back(rec.get());
+
+                std::sort(sorted.begin(), sorted.end(), [ ](const record *a, const record *b) 
+                { 
+                    return a->exclusive[TIME] > b->exclusive[TIME]; 
+                });
+
+                char buf[300];
+                std::snprintf(buf, sizeof buf, "%-20s %10s %10s %10s %12s %12s %10s %10s %12s %12s",
+                        "rule", "calls", "success", "fail", "consumed", "discarded", "memo hit", "memo miss", "incl ms", "excl ms");
+                os << buf;
+                if ( perf )
+                {
+                    std::snprintf(buf, sizeof buf, " %14s %12s", "excl cycles", "excl misses");
+                    os << buf;
+                }
+                os << '\n';
+
+                for ( const record *rec : sorted )
+                {
+                    char name[40];
+                    if ( rec->name )
+                        std::snprintf(name, sizeof name, "%s", rec->name);
+                    else
+                        std::snprintf(name, sizeof name, "rule@%p", rec->rule);
+
+                    std::snprintf(buf, sizeof buf, "%-20s %10llu %10llu %10llu %12llu %12llu %10llu %10llu %12.3f %12.3f",
+                            name, rec->calls, rec->successes, rec->failures, rec->consumed, rec->discarded, 
+                            rec->memo_hits, rec->memo_misses, rec->inclusive[TIME] / 1e6, rec->exclusive[TIME] / 1e6);
+                    os << buf;
+                    if ( perf )
+                    {
+                        std::snprintf(buf, sizeof buf, " %14llu %12llu", rec->exclusive[CYCLES], rec->exclusive[CACHE_MISSES]);
+                        os << buf;
+                    }
+                    os << '\n';
+                }
+            }
         };
+#endif
 
     } // namespace details
 
@@ -537,7 +1808,10 @@ namespace peg
         friend Expr Any();
         friend Expr Do(std::function<void()> f);
         friend Expr Pred(std::function<void(bool &)> f);
+        friend Expr Balanced(const std::string &pairs, const std::string &quotes, char escape);
         friend class Rule;
+        friend class details::analyzer;
+        friend class details::compiler;
 
         // Syntax tree structures
         struct Expression 
@@ -593,6 +1867,17 @@ namespace peg
 #endif
         };
 
+        struct BalExpr : Expression         // balanced group
+        {
+            details::matcher::bracket_set brackets;
+
+            BalExpr(const std::string &pairs, const std::string &quotes, char escape) : brackets(pairs, quotes, escape) { }
+            bool parse(details::matcher &m) const { return m.match_balanced(brackets); }
+#ifdef PEG_DEBUG
+            void visit(unsigned &cons) const { cons += 2; }
+#endif
+        };
+
         struct LahExpr : Expression         // lookahead predicate
         {
             ExprPtr exp;
@@ -716,8 +2001,9 @@ namespace peg
         {
             ExprPtr exp1, exp2;
             unsigned siz;
+            unsigned nlits;                         // alternatives if all are literals, else 0
 
-            AltExpr(ExprPtr e1, ExprPtr e2) : exp1(e1), exp2(e2), siz(std::max(e1->size(), e2->size())) { }
+            AltExpr(ExprPtr e1, ExprPtr e2, unsigned nl = 0) : exp1(e1), exp2(e2), siz(std::max(e1->size(), e2->size())), nlits(nl) { }
             unsigned size() const { return siz; }
             bool parse(details::matcher &m) const { return exp1->parse(m) || exp2->parse(m); }
 #ifdef PEG_DEBUG
@@ -734,13 +2020,107 @@ namespace peg
 #endif
         };
 
-        struct RepExpr : Expression         // repetition
+        struct TrieExpr : Expression        // prioritized choice of literals, maybe guarded by lookaheads
         {
-            ExprPtr exp;
-            unsigned nmin, nmax;
+            static const unsigned MINALTS = 8;
+
+            ExprPtr alt;                            // the choice as written, for analysis
             unsigned siz;
 
-            RepExpr(ExprPtr e, unsigned nmin, unsigned nmax) : exp(e), nmin(nmin), nmax(nmax), siz(e->size()) { };
+            // Built by the first parse, so that a choice of n literals is built once
+            // rather than by each of its n - 1 operators
+            mutable std::once_flag built;
+            mutable std::unique_ptr<const details::matcher::literal_trie> trie;    // null if not valid
+            mutable std::vector<ExprPtr> guards;    // by alternative, null if none
+
+            TrieExpr(ExprPtr a) : alt(a), siz(a->size()) { }
+            unsigned size() const { return siz; }
+
+            void build() const
+            {
+                std::vector<ExprPtr> alts;
+                std::vector<std::string> lits;
+                alternatives(alt, alts);
+                guards.resize(alts.size());
+                lits.resize(alts.size());
+                for ( unsigned i = 0 ; i < alts.size() ; i++ )
+                    literal(alts[i], lits[i], guards[i]);
+                trie = std::make_unique<const details::matcher::literal_trie>(lits);
+                if ( !trie->valid )
+                    trie.reset();
+            }
+
+            // One walk down the trie finds the literals that match. They are tried in 
+            // the order of the alternatives, checking their guards; failed guards rewind 
+            // as they do in the choice as written.
+            bool parse(details::matcher &m) const 
+            {
+                std::call_once(built, [this] { build(); });
+                if ( !trie )
+                    return alt->parse(m);
+
+                using literal_trie = details::matcher::literal_trie;
+                std::pair<unsigned, details::pos_t> found[literal_trie::MAXPATH], cand[literal_trie::MAXPATH];
+                details::matcher::mark mk;
+                m.set_mark(mk);
+                unsigned nc = 0;
+
+                unsigned k = m.match_trie(*trie, found);
+                for ( unsigned i = 0 ; i < k ; i++ )
+                {
+                    const literal_trie::node &nd = trie->nodes[found[i].first];
+                    for ( unsigned e = nd.ends ; e < nd.ends + nd.nends ; e++ )
+                        cand[nc++] = { trie->ends[e], found[i].second };
+                }
+                for ( unsigned i = 1 ; i < nc ; i++ )          // few, mostly in order
+                    for ( unsigned j = i ; j && cand[j] < cand[j - 1] ; j-- )
+                        std::swap(cand[j], cand[j - 1]);
+
+                unsigned l = m.get_level();
+                for ( unsigned i = 0 ; i < nc ; i++ )
+                {
+                    auto [a, p] = cand[i];
+                    m.pos = p;
+                    if ( !guards[a] )
+                        return true;
+                    m.set_level(l + 1);
+                    bool r = guards[a]->parse(m);
+                    m.set_level(l);
+                    if ( r )
+                        return true;
+                    m.go_mark(mk);
+                }
+
+                m.pos = mk.pos;             // past literals that did not match, as by match_string
+                return false;
+            }
+#ifdef PEG_DEBUG
+            void visit(unsigned &cons) const { alt->visit(cons); }
+#endif
+        };
+
+        struct DfaExpr : Expression         // regular expression, compiled to a DFA (see Compile)
+        {
+            ExprPtr exp;                            // the expression as written, for analysis
+            details::matcher::dfa dfa;
+            Encoding enc;                           // of the input it was compiled for
+            unsigned siz;
+
+            DfaExpr(ExprPtr e, details::matcher::dfa &&d, Encoding en) : exp(e), dfa(std::move(d)), enc(en), siz(e->size()) { }
+            unsigned size() const { return siz; }
+            bool parse(details::matcher &m) const { return m.enc == enc ? m.match_dfa(dfa) : exp->parse(m); }
+#ifdef PEG_DEBUG
+            void visit(unsigned &cons) const { exp->visit(cons); }
+#endif
+        };
+
+        struct RepExpr : Expression         // repetition
+        {
+            ExprPtr exp;
+            unsigned nmin, nmax;
+            unsigned siz;
+
+            RepExpr(ExprPtr e, unsigned nmin, unsigned nmax) : exp(e), nmin(nmin), nmax(nmax), siz(e->size()) { };
             unsigned size() const { return siz; }
             bool parse(details::matcher &m) const
             {
@@ -800,7 +2180,7 @@ namespace peg
             unsigned size() const { return siz; }
             bool parse(details::matcher &m) const
             {
-                unsigned b = m.begin_capture();
+                details::pos_t b = m.begin_capture();
                 bool r = exp->parse(m);
                 if ( r )
                     m.end_capture(b);
@@ -827,6 +2207,68 @@ namespace peg
         Expr(const Expr &r) = default;
         Expr &operator=(const Expr &r) = default;
 
+        // A literal alternative: a string or an ASCII char, alone or followed by a lookahead
+        static bool literal(const ExprPtr &e, std::string &s, ExprPtr &guard)
+        {
+            guard = nullptr;
+            if ( auto t = dynamic_cast<const StrExpr *>(e.get()) )
+                s = t->str;
+            else if ( auto c = dynamic_cast<const ChrExpr *>(e.get()) )
+            {
+                if ( c->ch >= 0x80 )
+                    return false;
+                s = std::string(1, char(c->ch));
+            }
+            else if ( auto q = dynamic_cast<const SeqExpr *>(e.get()) )
+            {
+                if ( !dynamic_cast<const LahExpr *>(q->exp2.get()) || !literal(q->exp1, s, guard) || guard )
+                    return false;
+                guard = q->exp2;
+            }
+            else
+                return false;
+            return true;
+        }
+
+        static void alternatives(const ExprPtr &e, std::vector<ExprPtr> &v)
+        {
+            if ( auto a = dynamic_cast<const AltExpr *>(e.get()) )
+            {
+                alternatives(a->exp1, v);
+                alternatives(a->exp2, v);
+            }
+            else
+                v.push_back(e);
+        }
+
+        // The alternatives of e if all are literals, else 0
+        static unsigned literals(const ExprPtr &e)
+        {
+            if ( auto a = dynamic_cast<const AltExpr *>(e.get()) )
+                return a->nlits;
+            std::string s;
+            ExprPtr g;
+            return literal(e, s, g);
+        }
+
+        // A choice, walking a trie if all alternatives are literals. Fewer alternatives
+        // are faster tried one after the other. Choices count their literals as they
+        // grow, and the trie is only built when parsing.
+        static Expr choice(ExprPtr e1, ExprPtr e2)
+        {
+            if ( auto t = dynamic_cast<const TrieExpr *>(e1.get()) )
+                e1 = t->alt;
+            if ( auto t = dynamic_cast<const TrieExpr *>(e2.get()) )
+                e2 = t->alt;
+            unsigned n1 = literals(e1), n2 = n1 ? literals(e2) : 0;
+            ExprPtr a(new AltExpr(e1, e2, n2 ? n1 + n2 : 0));
+
+            if ( !n2 || n1 + n2 < TrieExpr::MINALTS )
+                return a;
+            return ExprPtr(new TrieExpr(a));
+        }
+
+        Expr(ExprPtr e) : exp(e) { }
         Expr(const Expression *e) : exp(e) { }                                                      // from raw expression pointer
         operator ExprPtr() { return exp; }                                                          // to expression pointer
 
@@ -862,7 +2304,7 @@ namespace peg
         } 
         template <typename T, typename U> friend Expr operator|(const T &t, const U &u)             // ordered choice
         { 
-            return new AltExpr(Expr(t), Expr(u)); 
+            return choice(Expr(t), Expr(u)); 
         } 
     };
 
@@ -874,6 +2316,14 @@ namespace peg
     inline Expr Do(std::function<void()> f) { return Expr(f); }                                     // action
     inline Expr Pred(std::function<void(bool &)> f) { return Expr(f); }                             // semantic predicate
 
+    // A group from an opening bracket to its closing bracket, skipped by a fast scan that 
+    // only follows brackets and quoted strings. Pairs are opening and closing brackets, as 
+    // in "()[]{}"; inside quotes brackets are ignored and escape protects the next char.
+    inline Expr Balanced(const std::string &pairs, const std::string &quotes = "\"", char escape = '\\') 
+    { 
+        return new Expr::BalExpr(pairs, quotes, escape); 
+    }
+
     // Literals
     inline namespace literals
     {
@@ -883,6 +2333,26 @@ namespace peg
         inline Expr operator""_ccl(const char *s, std::size_t len) { return Ccl(std::string(s, len)); } // char class
     }
 
+#ifdef PEG_TRACE
+    // Trace hooks, enabled by defining PEG_TRACE.
+    // A tracer set on a parser is called when parse rounds and rule invocations
+    // begin and end, with input offsets counted from the start of the input.
+    class Tracer
+    {
+    public:
+
+        virtual ~Tracer() = default;
+
+        virtual void begin(unsigned long long pos) { }                                  // parse round
+        virtual void end(unsigned long long pos, bool result) { }
+        virtual void enter(const Rule &rule, unsigned long long pos) = 0;               // rule invocation
+        virtual void exit(const Rule &rule, unsigned long long pos, bool result) = 0;
+
+        // The name given with peg_debug(), or the label, of a rule
+        static const char *name(const Rule &rule);
+    };
+#endif
+
     // Grammar rules 
     class Rule : public Expr
     {
@@ -891,6 +2361,14 @@ namespace peg
 
         const char *label;      // for error reporting
         bool memoize;           // memoize parsing results
+        const char *name = nullptr;     // for debugging and profiling
+
+#ifdef PEG_PROFILE
+        mutable details::profiler::record *prof = nullptr;
+#endif
+
+        friend class details::analyzer;
+        friend class details::compiler;
 
         // A rule expression is a structure that holds a reference to the rule. 
         // This indirection allows rules to refer to other rules before they are defined.
@@ -909,7 +2387,6 @@ namespace peg
         // Variables for rule visitor
         bool visiting = false, visited = false; 
         unsigned my_cons;
-        const char *name = nullptr;
 
         // Visit the paths from this rule
         void visit(unsigned &cons)  
@@ -945,12 +2422,85 @@ namespace peg
         }
 #endif
 
+        // Count and trace an invocation
+        bool parse_traced(details::matcher &m) const
+        {
+#ifdef PEG_STATS
+            stats.rules++;
+#endif
+#ifdef PEG_HEATMAP
+            details::heatmap::scope hs(m.heat, this);
+#endif
+#ifdef PEG_TRACE
+            if ( m.tracer )
+            {
+                m.tracer->enter(*this, m.position());
+                bool r = parse_profiled(m);
+                m.tracer->exit(*this, m.position(), r);
+                return r;
+            }
+#endif
+            return parse_profiled(m);
+        }
+
+        bool parse_profiled(details::matcher &m) const
+        {
+#ifdef PEG_PROFILE
+            auto &profiler = details::profiler::get();
+            if ( !prof )
+                prof = profiler.add(name ? name : label, this);
+            std::size_t depth = profiler.depth();
+            profiler.enter(prof, m);
+            bool r;
+            try 
+            {
+                r = parse_body(m);
+            }
+            catch ( ... )
+            {
+                profiler.unwind(depth);
+                throw;
+            }
+            profiler.exit(m, r);
+            return r;
+#else
+            return parse_body(m);
+#endif
+        }
+
+        // Parse the root adjusting the base of value stack indices, recording a tree
+        // node if trees are built and this rule has a name or label.
+        bool parse_body(details::matcher &m) const
+        {
+            unsigned base = m.get_base();
+            m.set_base(m.get_level());
+#ifdef PEG_TREE
+            bool node = m.tree && (name || label);
+            std::size_t at = node ? m.open_node(this) : 0;
+            bool r = parse_root(m);
+            if ( node )
+                m.close_node(at, r);
+#else
+            bool r = parse_root(m);
+#endif
+            if ( label && !r )
+                m.set_error(label);
+            m.set_base(base);
+            return r;
+        }
+
         bool parse_root(details::matcher &m) const 
         { 
             if ( !memoize )
                 return root->parse(m);
 
             auto ptr = m.memo_lookup(this);
+#ifdef PEG_PROFILE
+            if ( ptr->found )
+                prof->memo_hits++;
+            else
+                prof->memo_misses++;
+#endif
             if ( ptr->found )
                 return ptr->result;
             if ( (ptr->result = root->parse(m)) )
@@ -982,24 +2532,24 @@ namespace peg
             const char *what() const noexcept { return str; }
         };
 
-        // Parse the root adjusting the base of value stack indices.
+        // Parse this rule, tracing and profiling it if enabled. Parses nesting rules
+        // deeper than the matcher allows fail.
         bool parse(details::matcher &m) const 
         { 
             if ( !root )
                 throw bad_rule("Uninitialized rule");
-            unsigned base = m.get_base();
-            m.set_base(m.get_level());
-            bool r = parse_root(m);
-            if ( label && !r )
-                m.set_error(label);
-            m.set_base(base);
-            return r;
+            if ( !m.enter() )
+                return false;
+            details::matcher::depth_scope ds(m);
+            return parse_traced(m);
         }
 
-#ifdef PEG_DEBUG
-        // Enable debugging.
+        // Set a name for debugging and profiling.
         void set_name(const char *debug_name) { name = debug_name; };
+        const char *get_name() const { return name; }
+        const char *get_label() const { return label; }
 
+#ifdef PEG_DEBUG
         // Check the grammar starting here for uninitialized rules and 
         // left recursion. This can be done only once.
         void check()
@@ -1013,85 +2563,2438 @@ namespace peg
 #endif
     };
 
-    namespace details
+#ifdef PEG_HEATMAP
+    inline const char *details::heatmap::name(const Rule *r)
     {
-        class parser
+        if ( !r )
+            return "(start)";
+        if ( r->get_name() )
+            return r->get_name();
+        return r->get_label() ? r->get_label() : "?";
+    }
+#endif
+
+#ifdef PEG_TRACE
+    inline const char *Tracer::name(const Rule &rule)
+    {
+        if ( rule.get_name() )
+            return rule.get_name();
+        return rule.get_label() ? rule.get_label() : "?";
+    }
+
+    // Aggregates rule call chains into folded stacks ("start;expr;term 1234"), the input 
+    // of flame graph tools. Weights are the time spent in each chain, excluding callees,
+    // in nanoseconds, or only the time spent in failed invocations.
+    class FoldedTracer : public Tracer
+    {
+        // A call chain
+        struct node
         {
-            Rule &__start;
+            const char *name;
+            std::size_t parent;
+            std::map<const Rule *, std::size_t> children;
+            unsigned long long time = 0, failed = 0;
 
-        protected:
+            node(const char *n, std::size_t p) : name(n), parent(p) { }
+        };
 
-            details::matcher __m;
+        // An active invocation
+        struct frame
+        {
+            std::size_t node;
+            unsigned long long start, children;
+        };
 
-        public:
+        std::vector<node> nodes { node("", 0) };
+        std::vector<frame> frames;
 
-            // Construct with starting rule and input stream
-            parser(Rule &r, std::istream &in = std::cin) : __start(r), __m(in) { }
+        static unsigned long long now() 
+        { 
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); 
+        }
 
-            // Parsing methods
-            bool parse() { return __start.parse(__m); }
-            void accept() { __m.accept(); }
-            void clear() { __m.clear(); }
-            std::string text() const { return __m.text(); }
-            std::string get_error() const { return __m.get_error(); } 
+        void write(std::ostream &os, std::size_t n, std::string &path, bool failed) const
+        {
+            std::size_t len = path.length();
+            if ( n )
+            {
+                if ( len )
+                    path += ';';
+                path += nodes[n].name;
 
-    #ifdef PEG_DEBUG
-            // Grammar check
-            void check() const { __start.check(); }
-    #endif
-        };
-    }
+                unsigned long long weight = failed ? nodes[n].failed : nodes[n].time;
+                if ( weight )
+                    os << path << ' ' << weight << '\n';
+            }
+            for ( const auto &[rule, child] : nodes[n].children )
+                write(os, child, path, failed);
+            path.resize(len);
+        }
 
-    // Parser 
-    template <typename T = void>
-    class Parser : public details::parser
-    {
-        details::value_stack<T> __values;
+    public:
 
-        // Extra state for memoizing val(0)
-        struct memo_state_extra : details::matcher::memo_state
+        void begin(unsigned long long pos) { frames.clear(); }
+
+        void enter(const Rule &rule, unsigned long long pos)
         {
-            T val0;
-            Parser *p;
+            std::size_t parent = frames.empty() ? 0 : frames.back().node;
+            auto iter = nodes[parent].children.find(std::addressof(rule));
+            std::size_t n;
+            if ( iter != nodes[parent].children.end() )
+                n = iter->second;
+            else
+            {
+                n = nodes.size();
+                nodes[parent].children[std::addressof(rule)] = n;
+                nodes.emplace_back(name(rule), parent);
+            }
+            frames.push_back(frame{ n, now(), 0 });
+        }
 
-            memo_state_extra(Parser *p) : p(p) { }
+        void exit(const Rule &rule, unsigned long long pos, bool result)
+        {
+            frame f = frames.back();
+            frames.pop_back();
+
+            unsigned long long elapsed = now() - f.start;
+            unsigned long long self = elapsed - f.children;
+            nodes[f.node].time += self;
+            if ( !result )
+                nodes[f.node].failed += self;
+            if ( !frames.empty() )
+                frames.back().children += elapsed;
+        }
 
-            virtual void save_extra() { val0 = p->val(0); }
-            virtual void restore_extra() { p->val(0) = val0; }
-        };
+        // Write the folded stacks, all or only those of failed invocations
+        void write(std::ostream &os, bool failed = false) const
+        {
+            std::string path;
+            write(os, 0, path, failed);
+        }
+    };
 
-        // Memo state allocator
-        std::function<details::matcher::memo_state *()> alloc = [ this ] { return new memo_state_extra{this}; };
+    // Streams Chrome trace_event JSON (chrome://tracing, Perfetto), with a begin and 
+    // an end event per parse round and rule invocation. Timestamps are in microseconds.
+    // The trace is complete once the tracer is destroyed or finish() is called.
+    class ChromeTracer : public Tracer
+    {
+        std::ostream &os;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool first = true, finished = false;
+
+        void event(const char *name, char phase, unsigned long long pos, int result = -1)
+        {
+            char buf[100];
+            double ts = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+            os << (first ? "\n" : ",\n") << "{\"name\": \"";
+            for ( const char *p = name ; *p ; p++ )
+            {
+                if ( *p == '"' || *p == '\\' )
+                    os << '\\';
+                os << *p;
+            }
+            std::snprintf(buf, sizeof buf, "\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": 1, \"args\": {\"pos\": %llu", phase, ts, pos);
+            os << buf;
+            if ( result >= 0 )
+                os << ", \"result\": " << (result ? "true" : "false");
+            os << "}}";
+            first = false;
+        }
 
     public:
 
-        // Construct with starting rule and input stream
-        Parser(Rule &r, std::istream &in = std::cin) : details::parser(r, in), __values(__m) { __m.use_vs(alloc); }
-        Parser(Rule &r, std::size_t capacity, std::istream &in = std::cin) : details::parser(r, in), __values(__m, capacity) { __m.use_vs(alloc); }
+        ChromeTracer(std::ostream &os) : os(os) { os << "{\"traceEvents\": ["; }
+        ~ChromeTracer() { finish(); }
 
-        // Reference to a value stack slot
-        T &val(std::size_t idx) { return __values[idx]; }
-        const T &val(std::size_t idx) const { return __values[idx]; }
+        void begin(unsigned long long pos) { event("parse", 'B', pos); }
+        void end(unsigned long long pos, bool result) { event("parse", 'E', pos, result); }
+        void enter(const Rule &rule, unsigned long long pos) { event(name(rule), 'B', pos); }
+        void exit(const Rule &rule, unsigned long long pos, bool result) { event(name(rule), 'E', pos, result); }
 
-        // Reference to a value contained in a variant type value stack slot
-        template <typename U> U &val(std::size_t idx) { return std::get<U>(__values[idx]); }
-        template <typename U> const U &val(std::size_t idx) const { return std::get<U>(__values[idx]); }
+        // Close the JSON document
+        void finish()
+        {
+            if ( finished )
+                return;
+            os << "\n]}\n";
+            os.flush();
+            finished = true;
+        }
     };
+#endif
 
-    template < >
-    class Parser <void> : public details::parser
+    namespace details
     {
-    public:
+        // Facts about an expression, assuming well-formed utf8 input
+        struct expr_info
+        {
+            bool nullable = false;          // may succeed without consuming input
+            bool infallible = false;        // always succeeds
+            std::bitset<256> first;         // bytes that a match consuming input may start with
 
-        using details::parser::parser;
-    };
+            bool operator==(const expr_info &i) const 
+            { 
+                return nullable == i.nullable && infallible == i.infallible && first == i.first; 
+            }
+        };
 
-} // namespace peg
+        // Static grammar analysis.
+        // Computes the facts above for every rule reachable from a start rule, as a fixpoint,
+        // and checks the grammar for uninitialized and left-recursive rules, alternatives that
+        // can never match, endless repetitions and choices that make the parser re-scan input.
+        class analyzer
+        {
+        public:
 
-#ifdef PEG_DEBUG
-// Set a rule's name for debugging
-#define peg_debug(rule)     rule.set_name(#rule)
-#endif
+            using Expression = Expr::Expression;
+
+            struct warning
+            {
+                enum level_t { ERROR, WARNING, NOTE, ADVICE } level;
+                const Rule *rule;
+                std::string message;
+            };
+
+        private:
+
+            static const unsigned DEPTH = 32;       // how deep guards and prefixes are followed into rules
+
+            // A literal prefix, a class or any character
+            struct prefix_t
+            {
+                enum kind_t { NONE, LIT, CCL, ANY } kind = NONE;
+                std::string lit;
+                const matcher::char_class *ccl = nullptr;
+
+                prefix_t() = default;
+                prefix_t(const std::string &s) : kind(s.empty() ? NONE : LIT), lit(s) { }
+                prefix_t(const matcher::char_class &c) : kind(CCL), ccl(&c) { }
+                prefix_t(kind_t k) : kind(k) { }
+            };
+
+            std::vector<const Rule *> rules;                            // reachable rules, in discovery order
+            std::map<const Rule *, expr_info> facts;
+            std::map<const Rule *, std::set<const Rule *>> left;        // rules each rule may call before consuming input
+            std::map<const Rule *, std::set<const Rule *>> reach;       // rules each rule may call
+            std::map<const Rule *, std::set<const Rule *>> shared;      // rules re-parsed by the choices of rules
+            std::vector<warning> warns;
+            Encoding enc;                                               // of the input facts hold for
+
+            // Tries and DFAs are analyzed as the expressions they were built from
+            template <typename N> static const N *as(const Expression &e) 
+            { 
+                if ( auto t = dynamic_cast<const Expr::TrieExpr *>(&e) )
+                    return as<N>(*t->alt);
+                if ( auto d = dynamic_cast<const Expr::DfaExpr *>(&e) )
+                    return as<N>(*d->exp);
+                return dynamic_cast<const N *>(&e); 
+            }
+
+            static const Rule *rule_of(const Expression &e)
+            {
+                auto r = as<Rule::RuleExpr>(e);
+                return r ? std::addressof(r->rule) : nullptr;
+            }
+
+            static expr_info sequence(const expr_info &i1, const expr_info &i2)
+            {
+                expr_info i;
+                i.nullable = i1.nullable && i2.nullable;
+                i.infallible = i1.infallible && i2.infallible;
+                i.first = i1.nullable ? i1.first | i2.first : i1.first;
+                return i;
+            }
+
+            // The bytes input holding c may start with in the encoding
+            std::bitset<256> char_first(char32_t c) const
+            {
+                std::bitset<256> fb;
+                if ( c < 0x80 || (enc != Encoding::UTF8 && c < 0x100) )
+                    fb.set(c);
+                else if ( enc == Encoding::UTF8 )
+                    for ( unsigned b = 0x80 ; b < 256 ; b++ )
+                        fb.set(b);
+                return fb;
+            }
+
+            // The bytes of c in the encoding, or nothing if they are not known
+            std::string char_bytes(char32_t c) const
+            {
+                if ( enc == Encoding::UTF8 )
+                    return encode(c);
+                return c < 0x100 ? std::string(1, char(c)) : std::string();
+            }
+
+            // The utf8 encoding of c, or nothing if input might hold c as a single byte
+            static std::string encode(char32_t c)
+            {
+                std::string s;
+                if ( c < 0x80 )
+                    s += char(c);
+                else if ( c < 0x100 )
+                    ;
+                else if ( c < 0x800 )
+                {
+                    s += char(0xC0 | c >> 6);
+                    s += char(0x80 | (c & 0x3F));
+                }
+                else if ( c < 0x10000 )
+                {
+                    s += char(0xE0 | c >> 12);
+                    s += char(0x80 | (c >> 6 & 0x3F));
+                    s += char(0x80 | (c & 0x3F));
+                }
+                else
+                {
+                    s += char(0xF0 | c >> 18);
+                    s += char(0x80 | (c >> 12 & 0x3F));
+                    s += char(0x80 | (c >> 6 & 0x3F));
+                    s += char(0x80 | (c & 0x3F));
+                }
+                return s;
+            }
+
+            // Alternatives of a choice and elements of a sequence, flattened
+            static void alternatives(const Expression &e, std::vector<const Expression *> &v)
+            {
+                if ( auto a = as<Expr::AltExpr>(e) )
+                {
+                    alternatives(*a->exp1, v);
+                    alternatives(*a->exp2, v);
+                }
+                else
+                    v.push_back(&e);
+            }
+
+            static void elements(const Expression &e, std::vector<const Expression *> &v)
+            {
+                if ( auto s = as<Expr::SeqExpr>(e) )
+                {
+                    elements(*s->exp1, v);
+                    elements(*s->exp2, v);
+                }
+                else if ( auto a = as<Expr::AttExpr>(e) )
+                {
+                    elements(*a->exp1, v);
+                    elements(*a->exp2, v);
+                }
+                else
+                    v.push_back(&e);
+            }
+
+            // Rules called by e, and rules e may call before consuming input, in order of appearance
+            template <typename C> void calls(const Expression &e, C &s, bool leftmost) const
+            {
+                if ( auto r = rule_of(e) )
+                    s.insert(s.end(), r);
+                else if ( auto l = as<Expr::LahExpr>(e) )
+                    calls(*l->exp, s, leftmost);
+                else if ( auto q = as<Expr::SeqExpr>(e) )
+                {
+                    calls(*q->exp1, s, leftmost);
+                    if ( !leftmost || info(*q->exp1).nullable )
+                        calls(*q->exp2, s, leftmost);
+                }
+                else if ( auto a = as<Expr::AttExpr>(e) )
+                {
+                    calls(*a->exp1, s, leftmost);
+                    if ( !leftmost || info(*a->exp1).nullable )
+                        calls(*a->exp2, s, leftmost);
+                }
+                else if ( auto a = as<Expr::AltExpr>(e) )
+                {
+                    calls(*a->exp1, s, leftmost);
+                    calls(*a->exp2, s, leftmost);
+                }
+                else if ( auto r = as<Expr::RepExpr>(e) )
+                    calls(*r->exp, s, leftmost);
+                else if ( auto c = as<Expr::CapExpr>(e) )
+                    calls(*c->exp, s, leftmost);
+            }
+
+            // The transitive closure of s over g
+            static std::set<const Rule *> closure(std::set<const Rule *> s, const std::map<const Rule *, std::set<const Rule *>> &g)
+            {
+                std::vector<const Rule *> todo(s.begin(), s.end());
+                while ( !todo.empty() )
+                {
+                    const Rule *r = todo.back();
+                    todo.pop_back();
+                    auto iter = g.find(r);
+                    if ( iter != g.end() )
+                        for ( auto c : iter->second )
+                            if ( s.insert(c).second )
+                                todo.push_back(c);
+                }
+                return s;
+            }
+
+            // Find the rules reachable from r
+            void discover(const Rule &r)
+            {
+                if ( facts.count(std::addressof(r)) )
+                    return;
+                facts[std::addressof(r)];
+                rules.push_back(std::addressof(r));
+                if ( !r.root )
+                    return;
+
+                std::vector<const Rule *> v;
+                calls(*r.root, v, false);
+                for ( auto c : v )
+                    discover(*c);
+            }
+
+            // Exact literal matched by e
+            bool exact(const Expression &e, std::string &s, unsigned depth) const
+            {
+                if ( auto t = as<Expr::StrExpr>(e) )
+                    s += t->str;
+                else if ( auto c = as<Expr::ChrExpr>(e) )
+                {
+                    std::string u = char_bytes(c->ch);
+                    if ( u.empty() )
+                        return false;
+                    s += u;
+                }
+                else if ( auto q = as<Expr::SeqExpr>(e) )
+                    return exact(*q->exp1, s, depth) && exact(*q->exp2, s, depth);
+                else if ( auto c = as<Expr::CapExpr>(e) )
+                    return exact(*c->exp, s, depth);
+                else if ( auto r = rule_of(e) )
+                    return depth && r->root && exact(*r->root, s, depth - 1);
+                else
+                    return false;
+                return true;
+            }
+
+            // What makes e succeed: e matches whenever input starts with the guard
+            prefix_t guard(const Expression &e, unsigned depth = DEPTH) const
+            {
+                std::string s;
+                if ( exact(e, s, depth) )
+                    return s;
+                if ( auto c = as<Expr::CclExpr>(e) )
+                    return c->ccl;
+                if ( as<Expr::AnyExpr>(e) )
+                    return prefix_t::ANY;
+                if ( auto q = as<Expr::SeqExpr>(e) )
+                {
+                    if ( info(*q->exp2).infallible )
+                        return guard(*q->exp1, depth);
+                    if ( exact(*q->exp1, s, depth) )
+                    {
+                        prefix_t g = guard(*q->exp2, depth);
+                        if ( g.kind == prefix_t::LIT )
+                            return s + g.lit;
+                    }
+                }
+                else if ( auto a = as<Expr::AttExpr>(e) )
+                {
+                    if ( info(*a->exp2).infallible )
+                        return guard(*a->exp1, depth);
+                }
+                else if ( auto r = as<Expr::RepExpr>(e) )
+                {
+                    if ( r->nmin == 1 )
+                        return guard(*r->exp, depth);
+                }
+                else if ( auto c = as<Expr::CapExpr>(e) )
+                    return guard(*c->exp, depth);
+                else if ( auto r = rule_of(e) )
+                {
+                    if ( depth && r->root )
+                        return guard(*r->root, depth - 1);
+                }
+                return { };
+            }
+
+            // What e needs to succeed: every match of e starts with the prefix
+            prefix_t prefix(const Expression &e, unsigned depth = DEPTH) const
+            {
+                std::string s;
+                if ( exact(e, s, depth) )
+                    return s;
+                if ( auto c = as<Expr::CclExpr>(e) )
+                    return c->ccl;
+                if ( as<Expr::AnyExpr>(e) )
+                    return prefix_t::ANY;
+                if ( auto q = as<Expr::SeqExpr>(e) )
+                {
+                    expr_info i1 = info(*q->exp1);
+                    if ( exact(*q->exp1, s, depth) )
+                    {
+                        prefix_t p = prefix(*q->exp2, depth);
+                        return p.kind == prefix_t::LIT ? s + p.lit : s;
+                    }
+                    if ( !i1.nullable )
+                        return prefix(*q->exp1, depth);
+                    if ( i1.first.none() )          // consumes nothing
+                        return prefix(*q->exp2, depth);
+                }
+                else if ( auto a = as<Expr::AttExpr>(e) )
+                {
+                    if ( !info(*a->exp1).nullable )
+                        return prefix(*a->exp1, depth);
+                }
+                else if ( auto a = as<Expr::AltExpr>(e) )
+                {
+                    prefix_t p1 = prefix(*a->exp1, depth), p2 = prefix(*a->exp2, depth);
+                    if ( p1.kind == prefix_t::LIT && p2.kind == prefix_t::LIT )
+                    {
+                        auto m = std::mismatch(p1.lit.begin(), p1.lit.end(), p2.lit.begin(), p2.lit.end());
+                        return std::string(p1.lit.begin(), m.first);
+                    }
+                }
+                else if ( auto r = as<Expr::RepExpr>(e) )
+                {
+                    if ( r->nmin )
+                        return prefix(*r->exp, depth);
+                }
+                else if ( auto c = as<Expr::CapExpr>(e) )
+                    return prefix(*c->exp, depth);
+                else if ( auto r = rule_of(e) )
+                {
+                    if ( depth && r->root )
+                        return prefix(*r->root, depth - 1);
+                }
+                return { };
+            }
+
+            // Whether an expression guarded by g always succeeds where one needing p could
+            static bool shadows(const prefix_t &g, const prefix_t &p)
+            {
+                if ( p.kind == prefix_t::NONE )
+                    return false;
+                switch ( g.kind )
+                {
+                case prefix_t::ANY:
+                    return true;
+                case prefix_t::LIT:
+                    return p.kind == prefix_t::LIT && p.lit.compare(0, g.lit.length(), g.lit) == 0;
+                case prefix_t::CCL:
+                    if ( p.kind == prefix_t::LIT )
+                        return g.ccl->find(matcher::decode(p.lit)[0]);
+                    return p.kind == prefix_t::CCL && g.ccl->includes(*p.ccl);
+                default:
+                    return false;
+                }
+            }
+
+            // The first bytes of the unbounded repetitions in e, if any
+            std::bitset<256> repeated(const Expression &e, unsigned depth = DEPTH) const
+            {
+                if ( auto r = as<Expr::RepExpr>(e) )
+                    return r->nmax ? repeated(*r->exp, depth) : info(*r->exp).first;
+                if ( auto q = as<Expr::SeqExpr>(e) )
+                    return repeated(*q->exp1, depth) | repeated(*q->exp2, depth);
+                if ( auto a = as<Expr::AttExpr>(e) )
+                    return repeated(*a->exp1, depth);
+                if ( auto c = as<Expr::CapExpr>(e) )
+                    return repeated(*c->exp, depth);
+                if ( auto r = rule_of(e) )
+                    if ( depth && r->root )
+                        return repeated(*r->root, depth - 1);
+                return { };
+            }
+
+            void warn(warning::level_t level, const Rule *r, const std::string &msg) { warns.push_back({ level, r, msg }); }
+
+            static std::string byte(unsigned b)
+            {
+                char buf[8];
+                std::snprintf(buf, sizeof buf, b >= ' ' && b < 0x7F ? "'%c'" : "'\\x%02X'", b);
+                return buf;
+            }
+
+            // Check the choice alts of rule r
+            void check_choice(const Rule &r, const std::vector<const Expression *> &alts)
+            {
+                std::set<const Rule *> reported;
+
+                for ( std::size_t j = 1 ; j < alts.size() ; j++ )
+                {
+                    std::string nj = std::to_string(j + 1);
+                    expr_info ij = info(*alts[j]);
+                    prefix_t pj = prefix(*alts[j]);
+                    std::set<const Rule *> lj;
+                    calls(*alts[j], lj, true);
+                    lj = closure(lj, left);
+
+                    for ( std::size_t i = 0 ; i < j ; i++ )
+                    {
+                        std::string ni = std::to_string(i + 1);
+                        expr_info ii = info(*alts[i]);
+                        prefix_t gi = guard(*alts[i]);
+
+                        if ( ii.infallible )
+                        {
+                            warn(warning::WARNING, std::addressof(r), "alternative " + nj + " is never tried, alternative " + ni + " always succeeds");
+                            break;
+                        }
+                        if ( shadows(gi, pj) )
+                        {
+                            warn(warning::WARNING, std::addressof(r), "alternative " + nj + " never matches, alternative " + ni + " matches first");
+                            break;
+                        }
+
+                        // Rules both alternatives may parse at the same position
+                        std::set<const Rule *> li, both;
+                        calls(*alts[i], li, true);
+                        li = closure(li, left);
+                        std::set_intersection(li.begin(), li.end(), lj.begin(), lj.end(), std::inserter(both, both.end()));
+                        for ( auto s : both )
+                        {
+                            // Report only the outermost ones
+                            bool inner = std::any_of(both.begin(), both.end(), [&](const Rule *o) { return o != s && left.at(o).count(s) && !left.at(s).count(o); });
+                            if ( inner || !reported.insert(s).second )
+                                continue;
+                            shared[s].insert(std::addressof(r));
+                            if ( reach.at(s).count(std::addressof(r)) )
+                                warn(warning::WARNING, std::addressof(r), "alternatives " + ni + " and " + nj + " may both parse " + name(s) + 
+                                        ", which recurses into " + name(std::addressof(r)) + ": failures of " + ni + " can re-parse input exponentially");
+                            else
+                                warn(warning::NOTE, std::addressof(r), "alternatives " + ni + " and " + nj + " may both parse " + name(s) + 
+                                        " at the same position, again when " + ni + " fails");
+                        }
+                        if ( both.empty() && gi.kind == prefix_t::NONE && (ii.first & ij.first).any() )
+                        {
+                            std::size_t b = 0;
+                            while ( !(ii.first & ij.first)[b] )
+                                b++;
+                            warn(warning::NOTE, std::addressof(r), "alternatives " + ni + " and " + nj + " overlap on " + byte(b) + 
+                                    ", input consumed by " + ni + " before failing is scanned again by " + nj);
+                        }
+                    }
+                }
+            }
+
+            // Check the unbounded repetition of body in rule r
+            void check_repetition(const Rule &r, const Expression &body)
+            {
+                if ( info(body).nullable )
+                {
+                    warn(warning::ERROR, std::addressof(r), "repetition of an expression that matches empty input never ends");
+                    return;
+                }
+
+                std::vector<const Expression *> alts;
+                alternatives(body, alts);
+                for ( std::size_t i = 0 ; i + 1 < alts.size() ; i++ )
+                {
+                    // An inner repetition followed by something that can fail
+                    std::vector<const Expression *> elems;
+                    elements(*alts[i], elems);
+                    std::bitset<256> rep;
+                    bool fallible = false;
+                    for ( auto e : elems )
+                    {
+                        if ( rep.any() && !info(*e).infallible )
+                            fallible = true;
+                        rep |= repeated(*e);
+                    }
+                    if ( !fallible )
+                        continue;
+
+                    for ( std::size_t j = i + 1 ; j < alts.size() ; j++ )
+                        if ( (info(*alts[j]).first & rep).any() )
+                        {
+                            warn(warning::NOTE, std::addressof(r), "in a repetition, alternative " + std::to_string(i + 1) + 
+                                    " can fail after an inner repetition, and alternative " + std::to_string(j + 1) + 
+                                    " steps over the same input: long runs are scanned quadratically");
+                            break;
+                        }
+                }
+            }
+
+            // Check the nodes of rule r
+            void check(const Rule &r, const Expression &e)
+            {
+                if ( as<Expr::AltExpr>(e) )
+                {
+                    std::vector<const Expression *> alts;
+                    alternatives(e, alts);
+                    check_choice(r, alts);
+                    for ( auto a : alts )
+                        check(r, *a);
+                }
+                else if ( auto l = as<Expr::LahExpr>(e) )
+                    check(r, *l->exp);
+                else if ( auto q = as<Expr::SeqExpr>(e) )
+                {
+                    check(r, *q->exp1);
+                    check(r, *q->exp2);
+                }
+                else if ( auto a = as<Expr::AttExpr>(e) )
+                {
+                    check(r, *a->exp1);
+                    check(r, *a->exp2);
+                }
+                else if ( auto p = as<Expr::RepExpr>(e) )
+                {
+                    if ( !p->nmax )
+                        check_repetition(r, *p->exp);
+                    check(r, *p->exp);
+                }
+                else if ( auto c = as<Expr::CapExpr>(e) )
+                    check(r, *c->exp);
+            }
+
+            // Memoization advice
+            void advise(const Rule &r)
+            {
+                auto iter = shared.find(std::addressof(r));
+                if ( iter == shared.end() )
+                {
+                    if ( r.memoize )
+                        warn(warning::ADVICE, std::addressof(r), "memoized, but no choice re-parses it at the same position: "
+                                "the memo table likely costs more than it saves");
+                    return;
+                }
+                if ( r.memoize )
+                    return;
+
+                std::string by;
+                for ( auto c : iter->second )
+                    by += (by.empty() ? "" : ", ") + name(c);
+
+                // Rules that do not recurse or run predicates are cheap to re-parse
+                std::set<const Rule *> s = reach.at(std::addressof(r));
+                s.insert(std::addressof(r));
+                if ( std::none_of(s.begin(), s.end(), [&](const Rule *c) { return reach.at(c).count(c) || (c->root && has_predicate(*c->root)); }) )
+                    warn(warning::ADVICE, std::addressof(r), "re-parsed by choices in " + by + ", factor it out of the alternatives");
+                else
+                    warn(warning::ADVICE, std::addressof(r), "re-parsed by choices in " + by + ", memoize it or factor it out of the alternatives");
+            }
+
+            static void literals(const Expression &e, std::set<std::string> &lits)
+            {
+                if ( auto t = as<Expr::StrExpr>(e) )
+                    lits.insert(t->str);
+                else if ( auto c = as<Expr::ChrExpr>(e) )
+                    lits.insert(c->ch < 0x100 ? std::string(1, char(c->ch)) : encode(c->ch));
+                else if ( auto c = as<Expr::CclExpr>(e) )
+                {
+                    for ( unsigned b = 0 ; b < 0x80 ; b++ )
+                        if ( c->ccl.find(b) )
+                            lits.insert(std::string(1, char(b)));
+                }
+                else if ( auto l = as<Expr::LahExpr>(e) )
+                    literals(*l->exp, lits);
+                else if ( auto q = as<Expr::SeqExpr>(e) )
+                {
+                    literals(*q->exp1, lits);
+                    literals(*q->exp2, lits);
+                }
+                else if ( auto a = as<Expr::AttExpr>(e) )
+                    literals(*a->exp1, lits);
+                else if ( auto a = as<Expr::AltExpr>(e) )
+                {
+                    literals(*a->exp1, lits);
+                    literals(*a->exp2, lits);
+                }
+                else if ( auto p = as<Expr::RepExpr>(e) )
+                    literals(*p->exp, lits);
+                else if ( auto c = as<Expr::CapExpr>(e) )
+                    literals(*c->exp, lits);
+            }
+
+            // The literals all matches of e start with, into h. False if some match may
+            // start otherwise.
+            bool heads(const Expression &e, std::set<std::string> &h, unsigned depth = 0) const
+            {
+                if ( depth > 32 )
+                    return false;
+                if ( auto t = as<Expr::StrExpr>(e) )
+                {
+                    h.insert(t->str);
+                    return !t->str.empty();
+                }
+                if ( auto c = as<Expr::ChrExpr>(e) )
+                {
+                    h.insert(char_bytes(c->ch));
+                    return !h.count("");
+                }
+                if ( auto q = as<Expr::SeqExpr>(e) )
+                    return heads(*q->exp1, h, depth + 1);
+                if ( auto a = as<Expr::AttExpr>(e) )
+                    return heads(*a->exp1, h, depth + 1);
+                if ( auto a = as<Expr::AltExpr>(e) )
+                    return heads(*a->exp1, h, depth + 1) && heads(*a->exp2, h, depth + 1);
+                if ( auto c = as<Expr::CapExpr>(e) )
+                    return heads(*c->exp, h, depth + 1);
+                if ( auto r = rule_of(e) )
+                    return r->root && heads(*r->root, h, depth + 1);
+                return false;
+            }
+
+            static bool has_predicate(const Expression &e)
+            {
+                if ( as<Expr::PredExpr>(e) )
+                    return true;
+                if ( auto l = as<Expr::LahExpr>(e) )
+                    return has_predicate(*l->exp);
+                if ( auto q = as<Expr::SeqExpr>(e) )
+                    return has_predicate(*q->exp1) || has_predicate(*q->exp2);
+                if ( auto a = as<Expr::AttExpr>(e) )
+                    return has_predicate(*a->exp1) || has_predicate(*a->exp2);
+                if ( auto a = as<Expr::AltExpr>(e) )
+                    return has_predicate(*a->exp1) || has_predicate(*a->exp2);
+                if ( auto p = as<Expr::RepExpr>(e) )
+                    return has_predicate(*p->exp);
+                if ( auto c = as<Expr::CapExpr>(e) )
+                    return has_predicate(*c->exp);
+                return false;
+            }
+
+        public:
+
+            analyzer(const Rule &start, Encoding e = Encoding::UTF8) : enc(e)
+            {
+                discover(start);
+
+                // Facts, as a fixpoint: nullable, infallible and first only grow
+                for ( bool changed = true ; changed ; )
+                {
+                    changed = false;
+                    for ( auto r : rules )
+                        if ( r->root )
+                        {
+                            expr_info i = info(*r->root);
+                            if ( !(i == facts[r]) )
+                            {
+                                facts[r] = i;
+                                changed = true;
+                            }
+                        }
+                }
+
+                // Call graphs
+                for ( auto r : rules )
+                    if ( r->root )
+                    {
+                        calls(*r->root, left[r], true);
+                        calls(*r->root, reach[r], false);
+                    }
+                    else
+                    {
+                        left[r];
+                        reach[r];
+                    }
+                for ( auto r : rules )
+                {
+                    left[r] = closure(left[r], left);
+                    reach[r] = closure(reach[r], reach);
+                }
+
+                // Checks
+                for ( auto r : rules )
+                {
+                    if ( !r->root )
+                        warn(warning::ERROR, r, "uninitialized rule");
+                    else if ( left[r].count(r) )
+                        warn(warning::ERROR, r, "left-recursive rule");
+                    else
+                        check(*r, *r->root);
+                }
+                for ( auto r : rules )
+                    if ( r->root )
+                        advise(*r);
+
+                std::stable_sort(warns.begin(), warns.end(), [ ](const warning &a, const warning &b) { return a.level < b.level; });
+            }
+
+            // Facts about an expression
+            expr_info info(const Expression &e) const
+            {
+                expr_info i;
+
+                if ( auto s = as<Expr::StrExpr>(e) )
+                {
+                    i.nullable = i.infallible = s->str.empty();
+                    if ( !s->str.empty() )
+                        i.first.set(s->str[0] & 0xFF);
+                }
+                else if ( auto c = as<Expr::ChrExpr>(e) )
+                    i.first = char_first(c->ch);
+                else if ( auto c = as<Expr::CclExpr>(e) )
+                    i.first = c->ccl.first_bytes(enc);
+                else if ( as<Expr::AnyExpr>(e) )
+                    i.first.set();
+                else if ( auto b = as<Expr::BalExpr>(e) )
+                {
+                    for ( unsigned c = 0 ; c < 256 ; c++ )
+                        if ( b->brackets.kind[c] == matcher::bracket_set::OPEN )
+                            i.first.set(c);
+                }
+                else if ( auto l = as<Expr::LahExpr>(e) )
+                {
+                    i.nullable = true;
+                    i.infallible = !l->invert && info(*l->exp).infallible;
+                }
+                else if ( as<Expr::DoExpr>(e) )
+                    i.nullable = i.infallible = true;
+                else if ( as<Expr::PredExpr>(e) )
+                    i.nullable = true;
+                else if ( auto q = as<Expr::SeqExpr>(e) )
+                    i = sequence(info(*q->exp1), info(*q->exp2));
+                else if ( auto a = as<Expr::AttExpr>(e) )
+                    i = sequence(info(*a->exp1), info(*a->exp2));
+                else if ( auto a = as<Expr::AltExpr>(e) )
+                {
+                    expr_info i1 = info(*a->exp1), i2 = info(*a->exp2);
+                    i.nullable = i1.nullable || i2.nullable;
+                    i.infallible = i1.infallible || i2.infallible;
+                    i.first = i1.infallible ? i1.first : i1.first | i2.first;
+                }
+                else if ( auto r = as<Expr::RepExpr>(e) )
+                {
+                    i = info(*r->exp);
+                    if ( !r->nmin )
+                        i.nullable = i.infallible = true;
+                }
+                else if ( auto c = as<Expr::CapExpr>(e) )
+                    i = info(*c->exp);
+                else if ( auto r = rule_of(e) )
+                {
+                    auto iter = facts.find(r);
+                    if ( iter != facts.end() )
+                        i = iter->second;
+                }
+                return i;
+            }
+
+            const expr_info &info(const Rule &r) const
+            {
+                static const expr_info none;
+                auto iter = facts.find(std::addressof(r));
+                return iter != facts.end() ? iter->second : none;
+            }
+
+            const std::vector<warning> &warnings() const { return warns; }
+
+            // The literals and class characters the grammar matches
+            std::vector<std::string> literals() const
+            {
+                std::set<std::string> lits;
+                for ( auto r : rules )
+                    if ( r->root )
+                        literals(*r->root, lits);
+                lits.erase("");
+                return { lits.begin(), lits.end() };
+            }
+
+            // The literals all matches of a rule start with, into h. False if unknown.
+            bool heads(const Rule &r, std::set<std::string> &h) const { return r.root && heads(*r.root, h); }
+
+            // The name given with peg_debug(), the label or the discovery number of a rule
+            std::string name(const Rule *r) const
+            {
+                if ( r->name )
+                    return r->name;
+                if ( r->label )
+                    return r->label;
+                return "rule " + std::to_string(std::find(rules.begin(), rules.end(), r) - rules.begin() + 1);
+            }
+        };
+    }
+
+    // Static grammar analysis of the rules reachable from a start rule.
+    // The facts computed for rules hold for well-formed input in the encoding given,
+    // utf8 by default.
+    class Analysis
+    {
+        details::analyzer an;
+
+    public:
+
+        Analysis(const Rule &start, Encoding enc = Encoding::UTF8) : an(start, enc) { }
+
+        // Facts about a rule
+        bool nullable(const Rule &r) const { return an.info(r).nullable; }         // may match empty input
+        bool infallible(const Rule &r) const { return an.info(r).infallible; }     // always succeeds
+        const std::bitset<256> &first(const Rule &r) const { return an.info(r).first; }   // bytes a non-empty match may start with
+
+        // The literals all matches of a rule start with, empty if unknown
+        std::vector<std::string> heads(const Rule &r) const
+        {
+            std::set<std::string> h;
+            if ( !an.heads(r, h) )
+                h.clear();
+            return { h.begin(), h.end() };
+        }
+
+        // Whether the grammar has uninitialized, left-recursive or endless rules
+        bool errors() const 
+        { 
+            return !an.warnings().empty() && an.warnings().front().level == details::analyzer::warning::ERROR; 
+        }
+
+        // Print the findings, most severe first
+        void report(std::ostream &os = std::cerr) const
+        {
+            static const char *const levels[] = { "error", "warning", "note", "advice" };
+            for ( const auto &w : an.warnings() )
+                os << an.name(w.rule) << ": " << levels[w.level] << ": " << w.message << '\n';
+            if ( an.warnings().empty() )
+                os << "analysis OK\n";
+        }
+    };
+
+    namespace details
+    {
+        // Compiles the regular parts of a grammar into DFAs over bytes.
+        // Literals, classes, sequences, choices and repetitions are regular, and so are
+        // rules with no label, name or memoization, and characters guarded by negative
+        // lookaheads that the next character decides. PEG choices and repetitions keep 
+        // the first way that matches, so a DFA matching as far as it can agrees with them
+        // only when the next character always tells which way to go: parts where it may
+        // not are left alone.
+        class compiler
+        {
+            using Expression = Expr::Expression;
+            using ExprPtr = Expr::ExprPtr;
+            using chars = std::vector<std::pair<char32_t, char32_t>>;     // sorted, disjoint ranges
+
+            static const char32_t MAXCHAR = 0x1FFFFF;       // the largest char getc32() decodes
+            static const char32_t MULTI = MAXCHAR + 1;      // first sets hold multi-byte chars c as MULTI + c
+            static const unsigned MAXNODES = 4096;          // NFA size limit
+            static const unsigned MAXSTATES = 1024;         // DFA size limit
+            static const unsigned DEPTH = 32;               // how deep rules are inlined
+
+            // A regular expression. Characters may be accepted in single bytes and in 
+            // multi-byte sequences, which negative lookaheads of strings tell apart.
+            struct regex
+            {
+                enum kind_t { SET, STR, SEQ, ALT, REP } kind;
+                chars one, multi;                           // SET
+                std::string str;                            // STR
+                std::shared_ptr<regex> r1, r2;              // SEQ, ALT, REP
+                unsigned nmin = 0, nmax = 0;                // REP
+
+                bool nullable = false;
+                chars first;
+            };
+
+            using rx = std::shared_ptr<regex>;
+
+            // What a lookahead does on the next character, single byte or not
+            struct peek_t
+            {
+                chars one_sure, one_maybe, multi_sure, multi_maybe;
+            };
+
+            // An NFA node
+            struct node
+            {
+                std::vector<std::pair<std::bitset<256>, unsigned>> edges;
+                std::vector<unsigned> eps;
+            };
+
+            Encoding enc;
+            std::vector<node> nfa;
+            std::vector<const Rule *> inlined;              // rules being inlined
+            std::set<const Rule *> done;
+
+            // Character sets
+
+            static chars unite(const chars &a, const chars &b)
+            {
+                chars all(a), u;
+                all.insert(all.end(), b.begin(), b.end());
+                std::sort(all.begin(), all.end());
+                for ( const auto &r : all )
+                    if ( !u.empty() && r.first <= u.back().second + 1 )
+                        u.back().second = std::max(u.back().second, r.second);
+                    else
+                        u.push_back(r);
+                return u;
+            }
+
+            static chars subtract(const chars &a, const chars &b)
+            {
+                chars d;
+                for ( auto r : a )
+                {
+                    for ( const auto &x : b )
+                    {
+                        if ( x.second < r.first || x.first > r.second )
+                            continue;
+                        if ( x.first > r.first )
+                            d.emplace_back(r.first, x.first - 1);
+                        if ( x.second >= r.second )
+                        {
+                            r.first = 1;
+                            r.second = 0;
+                            break;
+                        }
+                        r.first = x.second + 1;
+                    }
+                    if ( r.first <= r.second )
+                        d.push_back(r);
+                }
+                return d;
+            }
+
+            static bool subset(const chars &a, const chars &b) { return subtract(a, b).empty(); }
+            static bool disjoint(const chars &a, const chars &b) { return subtract(a, b) == a; }
+
+            // How much of lo to hi a set holds: 0 nothing, 1 part, 2 all
+            static unsigned covers(const chars &s, char32_t lo, char32_t hi)
+            {
+                std::uint64_t n = 0;
+                for ( const auto &r : s )
+                    if ( r.second >= lo && r.first <= hi )
+                        n += std::min(r.second, hi) - std::max(r.first, lo) + 1;
+                return !n ? 0 : n < std::uint64_t(hi) - lo + 1 ? 1 : 2;
+            }
+
+            // The continuation bytes that follow byte b as getc32() decodes it, and the 
+            // smallest char they may make
+            unsigned lead(unsigned b, char32_t &base) const
+            {
+                static const unsigned masks[] = { 0xFF, 0x1F, 0x0F, 0x07 };
+                unsigned k = b < 0xC0 || b >= 0xF8 || enc != Encoding::UTF8 ? 0 : b < 0xE0 ? 1 : b < 0xF0 ? 2 : 3;
+                base = char32_t(b & masks[k]) << 6 * k;
+                return k;
+            }
+
+            // Bytes whose low 6 bits are v
+            static std::bitset<256> low_bits(unsigned v)
+            {
+                std::bitset<256> bs;
+                for ( unsigned b = v ; b < 256 ; b += 0x40 )
+                    bs.set(b);
+                return bs;
+            }
+
+            static bool inlinable(const Rule &r) { return r.root && !r.label && !r.name && !r.memoize; }
+
+            // From PEG to regular expressions
+
+            // What a negative lookahead of e depends on, false if more than the next char
+            bool peek(const Expression &e, peek_t &p)
+            {
+                chars all { { 0, MAXCHAR } };
+
+                if ( auto t = dynamic_cast<const Expr::StrExpr *>(&e) )
+                {
+                    char32_t c;
+                    if ( t->str.empty() )
+                        p = { all, all, all, all };
+                    else if ( lead(t->str[0] & 0xFF, c) )
+                        return false;
+                    else if ( t->str.length() == 1 )
+                        p = { { { c, c } }, { { c, c } }, { }, { } };
+                    else
+                        p = { { }, { { c, c } }, { }, { } };
+                }
+                else if ( auto c = dynamic_cast<const Expr::ChrExpr *>(&e) )
+                    p = { { { c->ch, c->ch } }, { { c->ch, c->ch } }, { { c->ch, c->ch } }, { { c->ch, c->ch } } };
+                else if ( auto c = dynamic_cast<const Expr::CclExpr *>(&e) )
+                {
+                    chars s = c->ccl.ranges(MAXCHAR, enc == Encoding::BYTES);
+                    p = { s, s, s, s };
+                }
+                else if ( dynamic_cast<const Expr::AnyExpr *>(&e) )
+                    p = { all, all, all, all };
+                else if ( auto a = dynamic_cast<const Expr::AltExpr *>(&e) )
+                {
+                    peek_t p2;
+                    if ( !peek(*a->exp1, p) || !peek(*a->exp2, p2) )
+                        return false;
+                    p = { unite(p.one_sure, p2.one_sure), unite(p.one_maybe, p2.one_maybe), 
+                          unite(p.multi_sure, p2.multi_sure), unite(p.multi_maybe, p2.multi_maybe) };
+                }
+                else if ( auto a = dynamic_cast<const Expr::AttExpr *>(&e) )   // actions in lookaheads are dropped
+                    return dynamic_cast<const Expr::DoExpr *>(a->exp2.get()) && peek(*a->exp1, p);
+                else if ( auto c = dynamic_cast<const Expr::CapExpr *>(&e) )
+                    return peek(*c->exp, p);
+                else if ( auto t = dynamic_cast<const Expr::TrieExpr *>(&e) )
+                    return peek(*t->alt, p);
+                else if ( auto d = dynamic_cast<const Expr::DfaExpr *>(&e) )
+                    return peek(*d->exp, p);
+                else if ( auto r = dynamic_cast<const Rule::RuleExpr *>(&e) )
+                {
+                    if ( !inlinable(r->rule) || inlined.size() == DEPTH || 
+                         std::count(inlined.begin(), inlined.end(), std::addressof(r->rule)) )
+                        return false;
+                    inlined.push_back(std::addressof(r->rule));
+                    bool ok = peek(*r->rule.root, p);
+                    inlined.pop_back();
+                    return ok;
+                }
+                else
+                    return false;
+                return true;
+            }
+
+            // The regular expression equivalent to e, null if not regular
+            rx convert(const Expression &e)
+            {
+                auto r = std::make_shared<regex>();
+                chars all { { 0, MAXCHAR } };
+
+                if ( auto t = dynamic_cast<const Expr::StrExpr *>(&e) )
+                {
+                    r->kind = regex::STR;
+                    r->str = t->str;
+                }
+                else if ( auto c = dynamic_cast<const Expr::ChrExpr *>(&e) )
+                {
+                    r->kind = regex::SET;
+                    r->one = r->multi = { { c->ch, c->ch } };
+                }
+                else if ( auto c = dynamic_cast<const Expr::CclExpr *>(&e) )
+                {
+                    r->kind = regex::SET;
+                    r->one = r->multi = c->ccl.ranges(MAXCHAR, enc == Encoding::BYTES);
+                }
+                else if ( dynamic_cast<const Expr::AnyExpr *>(&e) )
+                {
+                    r->kind = regex::SET;
+                    r->one = r->multi = all;
+                }
+                else if ( auto q = dynamic_cast<const Expr::SeqExpr *>(&e) )
+                {
+                    // A character not starting what a lookahead matches
+                    auto l = dynamic_cast<const Expr::LahExpr *>(q->exp1.get());
+                    if ( l && l->invert )
+                    {
+                        peek_t p;
+                        rx c = convert(*q->exp2);
+                        if ( !c || c->kind != regex::SET || !peek(*l->exp, p) || 
+                             !subset(p.one_maybe, p.one_sure) || !subset(p.multi_maybe, p.multi_sure) )
+                            return nullptr;
+                        r->kind = regex::SET;
+                        r->one = subtract(c->one, p.one_sure);
+                        r->multi = subtract(c->multi, p.multi_sure);
+                        return r;
+                    }
+                    r->kind = regex::SEQ;
+                    if ( !(r->r1 = convert(*q->exp1)) || !(r->r2 = convert(*q->exp2)) )
+                        return nullptr;
+                }
+                else if ( auto a = dynamic_cast<const Expr::AltExpr *>(&e) )
+                {
+                    r->kind = regex::ALT;
+                    if ( !(r->r1 = convert(*a->exp1)) || !(r->r2 = convert(*a->exp2)) )
+                        return nullptr;
+                }
+                else if ( auto p = dynamic_cast<const Expr::RepExpr *>(&e) )
+                {
+                    r->kind = regex::REP;
+                    r->nmin = p->nmin;
+                    r->nmax = p->nmax;
+                    if ( !(r->r1 = convert(*p->exp)) )
+                        return nullptr;
+                }
+                else if ( auto t = dynamic_cast<const Expr::TrieExpr *>(&e) )
+                    return convert(*t->alt);
+                else if ( auto d = dynamic_cast<const Expr::DfaExpr *>(&e) )
+                    return convert(*d->exp);
+                else if ( auto u = dynamic_cast<const Rule::RuleExpr *>(&e) )
+                {
+                    if ( !inlinable(u->rule) || inlined.size() == DEPTH || 
+                         std::count(inlined.begin(), inlined.end(), std::addressof(u->rule)) )
+                        return nullptr;
+                    inlined.push_back(std::addressof(u->rule));
+                    r = convert(*u->rule.root);
+                    inlined.pop_back();
+                }
+                else
+                    return nullptr;
+                return r;
+            }
+
+            // Compute nullability and first chars, which getc32() decodes from single 
+            // bytes or from multi-byte sequences
+            void annotate(regex &r) const
+            {
+                switch ( r.kind )
+                {
+                    case regex::SET:
+                        if ( enc != Encoding::UTF8 )
+                        {
+                            r.first = subtract(r.one, { { 0x100, MAXCHAR } });
+                            break;
+                        }
+                        r.first = subtract(r.one, { { 0xC0, 0xF7 }, { 0x100, MAXCHAR } });
+                        for ( const auto &c : r.multi )
+                            r.first.emplace_back(MULTI + c.first, MULTI + c.second);
+                        break;
+                    case regex::STR:
+                        r.nullable = r.str.empty();
+                        if ( !r.nullable )
+                        {
+                            char32_t base;
+                            unsigned k = lead(r.str[0] & 0xFF, base);
+                            if ( k )
+                                r.first = { { MULTI + base, MULTI + base + (1u << 6 * k) - 1 } };
+                            else
+                                r.first = { { base, base } };
+                        }
+                        break;
+                    case regex::SEQ:
+                        annotate(*r.r1);
+                        annotate(*r.r2);
+                        r.nullable = r.r1->nullable && r.r2->nullable;
+                        r.first = r.r1->nullable ? unite(r.r1->first, r.r2->first) : r.r1->first;
+                        break;
+                    case regex::ALT:
+                        annotate(*r.r1);
+                        annotate(*r.r2);
+                        r.nullable = r.r1->nullable || r.r2->nullable;
+                        r.first = unite(r.r1->first, r.r2->first);
+                        break;
+                    case regex::REP:
+                        annotate(*r.r1);
+                        r.nullable = !r.nmin || r.r1->nullable;
+                        r.first = r.r1->first;
+                        break;
+                }
+            }
+
+            // Whether the next char always tells which way to go, given the chars that
+            // may follow
+            static bool deterministic(const regex &r, const chars &follow)
+            {
+                switch ( r.kind )
+                {
+                    case regex::SEQ:
+                        return deterministic(*r.r1, r.r2->nullable ? unite(r.r2->first, follow) : r.r2->first) && 
+                               deterministic(*r.r2, follow);
+                    case regex::ALT:
+                        return !r.r1->nullable && 
+                               disjoint(r.r1->first, r.r2->nullable ? unite(r.r2->first, follow) : r.r2->first) &&
+                               deterministic(*r.r1, follow) && deterministic(*r.r2, follow);
+                    case regex::REP:
+                        return !r.r1->nullable && 
+                               ((r.nmax && r.nmax <= r.nmin) || disjoint(r.r1->first, follow)) &&
+                               deterministic(*r.r1, unite(r.r1->first, follow));
+                    default:
+                        return true;
+                }
+            }
+
+            // Worth a DFA: more than one char or string
+            static bool worth(const regex &r) { return r.kind != regex::SET && r.kind != regex::STR; }
+
+            // NFA construction
+
+            unsigned add()
+            {
+                nfa.emplace_back();
+                return nfa.size() - 1;
+            }
+
+            void edge(unsigned s, const std::bitset<256> &bs, unsigned t) { nfa[s].edges.emplace_back(bs, t); }
+
+            // A node n arbitrary bytes before t
+            unsigned bytes(unsigned n, unsigned t)
+            {
+                for ( ; n ; n-- )
+                {
+                    unsigned s = add();
+                    edge(s, std::bitset<256>().set(), t);
+                    t = s;
+                }
+                return t;
+            }
+
+            // The last k continuation bytes of chars of s from base on, from node n to t
+            void continuation(const chars &s, char32_t base, unsigned k, unsigned n, unsigned t)
+            {
+                std::bitset<256> full;
+                for ( unsigned v = 0 ; v < 0x40 ; v++ )
+                {
+                    char32_t lo = base + (char32_t(v) << 6 * (k - 1)), hi = lo + (1u << 6 * (k - 1)) - 1;
+                    switch ( covers(s, lo, hi) )
+                    {
+                        case 1:
+                        {
+                            unsigned m = add();
+                            edge(n, low_bits(v), m);
+                            continuation(s, lo, k - 1, m, t);
+                            break;
+                        }
+                        case 2:
+                            full |= low_bits(v);
+                            break;
+                    }
+                }
+                if ( full.any() )
+                    edge(n, full, bytes(k - 1, t));
+            }
+
+            // The chars of a set, as getc32() decodes them, from node n to t
+            void characters(const regex &r, unsigned n, unsigned t)
+            {
+                std::bitset<256> single, full[4];
+                for ( unsigned b = 0 ; b < 256 ; b++ )
+                {
+                    char32_t base;
+                    unsigned k = lead(b, base);
+                    if ( !k )
+                    {
+                        if ( covers(r.one, b, b) )
+                            single.set(b);
+                        continue;
+                    }
+                    switch ( covers(r.multi, base, base + (1u << 6 * k) - 1) )
+                    {
+                        case 1:
+                        {
+                            unsigned m = add();
+                            edge(n, std::bitset<256>().set(b), m);
+                            continuation(r.multi, base, k, m, t);
+                            break;
+                        }
+                        case 2:
+                            full[k].set(b);
+                            break;
+                    }
+                }
+                if ( single.any() )
+                    edge(n, single, t);
+                for ( unsigned k = 1 ; k < 4 ; k++ )
+                    if ( full[k].any() )
+                        edge(n, full[k], bytes(k, t));
+            }
+
+            // Build r from node n, returning the node where it ends
+            unsigned build(const regex &r, unsigned n)
+            {
+                if ( nfa.size() > MAXNODES )
+                    return n;
+
+                switch ( r.kind )
+                {
+                    case regex::SET:
+                    {
+                        unsigned t = add();
+                        characters(r, n, t);
+                        return t;
+                    }
+                    case regex::STR:
+                        for ( char c : r.str )
+                        {
+                            unsigned t = add();
+                            edge(n, std::bitset<256>().set(c & 0xFF), t);
+                            n = t;
+                        }
+                        return n;
+                    case regex::SEQ:
+                        return build(*r.r2, build(*r.r1, n));
+                    case regex::ALT:
+                    {
+                        unsigned t = add(), t1 = build(*r.r1, n), t2 = build(*r.r2, n);
+                        nfa[t1].eps.push_back(t);
+                        nfa[t2].eps.push_back(t);
+                        return t;
+                    }
+                    case regex::REP:
+                    {
+                        for ( unsigned i = 0 ; i < r.nmin ; i++ )
+                            n = build(*r.r1, n);
+                        unsigned t = add();
+                        nfa[n].eps.push_back(t);
+                        if ( !r.nmax )
+                            nfa[build(*r.r1, t)].eps.push_back(t);
+                        else
+                            for ( unsigned i = r.nmin ; i < r.nmax ; i++ )
+                            {
+                                n = build(*r.r1, n);
+                                nfa[n].eps.push_back(t);
+                            }
+                        return t;
+                    }
+                }
+                return n;
+            }
+
+            void closure(std::vector<unsigned> &set) const
+            {
+                for ( unsigned i = 0 ; i < set.size() ; i++ )
+                    for ( unsigned t : nfa[set[i]].eps )
+                        if ( std::find(set.begin(), set.end(), t) == set.end() )
+                            set.push_back(t);
+                std::sort(set.begin(), set.end());
+            }
+
+            // The DFA of r, by subset construction. False if too large.
+            bool automaton(const regex &r, matcher::dfa &d)
+            {
+                nfa.clear();
+                unsigned start = add(), end = build(r, start);
+                if ( nfa.size() > MAXNODES )
+                    return false;
+
+                std::vector<std::vector<unsigned>> states { { }, { start } };
+                std::map<std::vector<unsigned>, unsigned> ids;
+                std::vector<std::vector<unsigned>> next(2, std::vector<unsigned>(256));
+                closure(states[1]);
+                ids[states[0]] = 0;
+                ids[states[1]] = 1;
+
+                for ( unsigned s = 1 ; s < states.size() ; s++ )
+                    for ( unsigned b = 0 ; b < 256 ; b++ )
+                    {
+                        std::vector<unsigned> set;
+                        for ( unsigned n : states[s] )
+                            for ( const auto &e : nfa[n].edges )
+                                if ( e.first[b] && std::find(set.begin(), set.end(), e.second) == set.end() )
+                                    set.push_back(e.second);
+                        closure(set);
+                        auto iter = ids.find(set);
+                        if ( iter == ids.end() )
+                        {
+                            if ( states.size() == MAXSTATES )
+                                return false;
+                            iter = ids.emplace(set, states.size()).first;
+                            states.push_back(set);
+                            next.emplace_back(256);
+                        }
+                        next[s][b] = iter->second;
+                    }
+
+                // Bytes that lead to the same states share a class
+                std::map<std::vector<unsigned>, unsigned> classes;
+                std::vector<std::vector<unsigned>> columns;
+                for ( unsigned b = 0 ; b < 256 ; b++ )
+                {
+                    std::vector<unsigned> col;
+                    for ( const auto &row : next )
+                        col.push_back(row[b]);
+                    auto iter = classes.emplace(col, columns.size()).first;
+                    if ( iter->second == columns.size() )
+                        columns.push_back(col);
+                    d.cls[b] = iter->second;
+                }
+
+                d.nclasses = columns.size();
+                d.delta.assign(states.size() * d.nclasses, 0);
+                d.accept.assign(states.size(), 0);
+                for ( unsigned s = 0 ; s < states.size() ; s++ )
+                {
+                    for ( unsigned c = 0 ; c < d.nclasses ; c++ )
+                        d.delta[s * d.nclasses + c] = columns[c][s];
+                    d.accept[s] = std::binary_search(states[s].begin(), states[s].end(), end);
+                }
+                return true;
+            }
+
+            // An expression with its regular parts compiled
+            ExprPtr compile(const ExprPtr &e)
+            {
+                if ( dynamic_cast<const Expr::DfaExpr *>(e.get()) || dynamic_cast<const Expr::TrieExpr *>(e.get()) ||
+                     dynamic_cast<const Rule::RuleExpr *>(e.get()) )
+                    return e;
+
+                rx r = convert(*e);
+                matcher::dfa d;
+                if ( r && worth(*r) )
+                {
+                    annotate(*r);
+                    if ( deterministic(*r, { }) && automaton(*r, d) )
+                        return std::make_shared<const Expr::DfaExpr>(e, std::move(d), enc);
+                }
+
+                if ( auto q = dynamic_cast<const Expr::SeqExpr *>(e.get()) )
+                {
+                    auto e1 = compile(q->exp1), e2 = compile(q->exp2);
+                    return e1 == q->exp1 && e2 == q->exp2 ? e : std::make_shared<const Expr::SeqExpr>(e1, e2);
+                }
+                if ( auto a = dynamic_cast<const Expr::AttExpr *>(e.get()) )
+                {
+                    auto e1 = compile(a->exp1);
+                    return e1 == a->exp1 ? e : std::make_shared<const Expr::AttExpr>(e1, a->exp2);
+                }
+                if ( auto a = dynamic_cast<const Expr::AltExpr *>(e.get()) )
+                {
+                    auto e1 = compile(a->exp1), e2 = compile(a->exp2);
+                    return e1 == a->exp1 && e2 == a->exp2 ? e : std::make_shared<const Expr::AltExpr>(e1, e2);
+                }
+                if ( auto p = dynamic_cast<const Expr::RepExpr *>(e.get()) )
+                {
+                    auto e1 = compile(p->exp);
+                    return e1 == p->exp ? e : std::make_shared<const Expr::RepExpr>(e1, p->nmin, p->nmax);
+                }
+                if ( auto c = dynamic_cast<const Expr::CapExpr *>(e.get()) )
+                {
+                    auto e1 = compile(c->exp);
+                    return e1 == c->exp ? e : std::make_shared<const Expr::CapExpr>(e1);
+                }
+                if ( auto l = dynamic_cast<const Expr::LahExpr *>(e.get()) )
+                {
+                    auto e1 = compile(l->exp);
+                    return e1 == l->exp ? e : std::make_shared<const Expr::LahExpr>(e1, l->invert);
+                }
+                return e;
+            }
+
+            // The rules an expression calls
+            static void calls(const Expression &e, std::vector<Rule *> &v)
+            {
+                if ( auto r = dynamic_cast<const Rule::RuleExpr *>(&e) )
+                    v.push_back(std::addressof(r->rule));
+                else if ( auto q = dynamic_cast<const Expr::SeqExpr *>(&e) )
+                {
+                    calls(*q->exp1, v);
+                    calls(*q->exp2, v);
+                }
+                else if ( auto a = dynamic_cast<const Expr::AttExpr *>(&e) )
+                {
+                    calls(*a->exp1, v);
+                    calls(*a->exp2, v);
+                }
+                else if ( auto a = dynamic_cast<const Expr::AltExpr *>(&e) )
+                {
+                    calls(*a->exp1, v);
+                    calls(*a->exp2, v);
+                }
+                else if ( auto p = dynamic_cast<const Expr::RepExpr *>(&e) )
+                    calls(*p->exp, v);
+                else if ( auto c = dynamic_cast<const Expr::CapExpr *>(&e) )
+                    calls(*c->exp, v);
+                else if ( auto l = dynamic_cast<const Expr::LahExpr *>(&e) )
+                    calls(*l->exp, v);
+                else if ( auto t = dynamic_cast<const Expr::TrieExpr *>(&e) )
+                    calls(*t->alt, v);              // guards included
+                else if ( auto d = dynamic_cast<const Expr::DfaExpr *>(&e) )
+                    calls(*d->exp, v);
+            }
+
+        public:
+
+            compiler(Encoding e) : enc(e) { }
+
+            // Compile the rules reachable from start
+            void compile(Rule &start)
+            {
+                std::vector<Rule *> todo { std::addressof(start) };
+                while ( !todo.empty() )
+                {
+                    Rule *r = todo.back();
+                    todo.pop_back();
+                    if ( !r->root || !done.insert(r).second )
+                        continue;
+                    r->root = compile(r->root);
+                    calls(*r->root, todo);
+                }
+            }
+        };
+    }
+
+    // Compile the regular parts of the rules reachable from a start rule into DFAs, 
+    // which match them in one pass over input bytes (see details::compiler). Rules 
+    // are inlined into the DFAs of the rules calling them, and no longer count in 
+    // statistics, profiles or traces there. DFAs read input in the given encoding,
+    // parsers reading another one run the expressions they were compiled from. Call
+    // it once the grammar is complete.
+    inline void Compile(Rule &start, Encoding enc = Encoding::UTF8) { details::compiler(enc).compile(start); }
+
+#ifdef PEG_STATS
+    // Adversarial input search, enabled by defining PEG_STATS.
+    // Looks for the inputs that make a grammar work hardest: starting from sample inputs,
+    // it mutates the worst inputs found so far with the grammar's literals, random bytes,
+    // deletions, repetitions and splices, and runs them, measuring engine work as rule 
+    // invocations + bytes read + backtracks. The run function must parse all of its input.
+    class SlowInputs
+    {
+    public:
+
+        static const unsigned TOP = 16;         // worst inputs kept
+
+        struct result
+        {
+            std::string input;
+            unsigned long long work, bytes, rules, backtracks, memo;
+        };
+
+    private:
+
+        std::function<void(std::istream &)> run;
+        std::vector<std::string> tokens;
+        std::vector<result> worst;              // by decreasing work
+        std::mt19937 rng;
+
+        std::size_t random(std::size_t n) { return n ? rng() % n : 0; }
+
+        // Keep r if it is among the worst inputs
+        void keep(result &&r)
+        {
+            for ( const auto &w : worst )
+                if ( w.input == r.input )
+                    return;
+            if ( worst.size() == TOP && r.work <= worst.back().work )
+                return;
+            auto iter = std::upper_bound(worst.begin(), worst.end(), r, [ ](const result &a, const result &b) { return a.work > b.work; });
+            worst.insert(iter, std::move(r));
+            if ( worst.size() > TOP )
+                worst.pop_back();
+        }
+
+        std::string mutate(std::string s, std::size_t maxlen)
+        {
+            for ( unsigned n = 1 + random(3) ; n ; n-- )
+            {
+                std::size_t pos = random(s.length() + 1), len = 1 + random(s.length() / 4 + 1);
+                const std::string &tok = tokens.empty() ? s : tokens[random(tokens.size())];
+                const std::string &other = worst.empty() ? s : worst[random(worst.size())].input;
+
+                switch ( random(6) )
+                {
+                case 0:         // insert a literal
+                    s.insert(pos, tok);
+                    break;
+                case 1:         // replace with a literal
+                    s.replace(pos, len, tok);
+                    break;
+                case 2:         // delete
+                    s.erase(pos, len);
+                    break;
+                case 3:         // repeat
+                    s.insert(pos, s.substr(pos, len));
+                    break;
+                case 4:         // splice with another input
+                    s = s.substr(0, pos) + other.substr(std::min(pos, other.length()));
+                    break;
+                default:        // random byte
+                    if ( pos < s.length() )
+                        s[pos] = char(random(256));
+                    else
+                        s += char(random(256));
+                    break;
+                }
+            }
+            if ( s.length() > maxlen )
+                s.resize(maxlen);
+            return s;
+        }
+
+        // s repeated to len bytes
+        static std::string pump(const std::string &s, std::size_t len)
+        {
+            std::string p;
+            while ( p.length() < len )
+                p += s;
+            p.resize(len);
+            return p;
+        }
+
+        static std::string quote(const std::string &s, std::size_t max)
+        {
+            std::string q = "\"";
+            char buf[8];
+            for ( std::size_t i = 0 ; i < s.length() && i < max ; i++ )
+            {
+                unsigned char c = s[i];
+                if ( c == '"' || c == '\\' )
+                    q += '\\';
+                if ( c >= ' ' && c < 0x7F )
+                    q += char(c);
+                else
+                {
+                    std::snprintf(buf, sizeof buf, "\\x%02X", c);
+                    q += buf;
+                }
+            }
+            return q + (s.length() > max ? "\"..." : "\"");
+        }
+
+    public:
+
+        // Search the grammar starting at start, parsed by run
+        SlowInputs(const Rule &start, std::function<void(std::istream &)> run, unsigned seed = 1) : 
+            run(run), tokens(details::analyzer(start).literals()), rng(seed) { }
+
+        // Run an input measuring its work
+        result measure(const std::string &s)
+        {
+            Stats before = stats;
+            std::istringstream in(s);
+            run(in);
+            result r { s, 0, stats.bytes - before.bytes, stats.rules - before.rules, stats.backtracks - before.backtracks, stats.memo - before.memo };
+            r.work = r.bytes + r.rules + r.backtracks;
+            return r;
+        }
+
+        // Add a sample input
+        void sample(const std::string &s) { keep(measure(s)); }
+
+        // Run rounds mutations of inputs up to maxlen bytes
+        void search(unsigned rounds, std::size_t maxlen)
+        {
+            if ( worst.empty() )
+                sample("");
+            for ( unsigned i = 0 ; i < rounds ; i++ )
+            {
+                // Favor the worst inputs
+                const std::string &parent = worst[std::min(random(worst.size()), random(worst.size()))].input;
+                keep(measure(mutate(parent, maxlen)));
+            }
+        }
+
+        const std::vector<result> &results() const { return worst; }
+
+        // Print the worst inputs, and the work per byte of the worst one repeated to doubling
+        // lengths, with the growth exponent (1 is linear, 2 quadratic). Stops before the work 
+        // is expected to exceed budget, or at maxlen bytes.
+        void report(std::ostream &os = std::cerr, unsigned long long budget = 100000000, std::size_t maxlen = 1 << 16)
+        {
+            char buf[200];
+
+            os << "worst inputs (work = rule invocations + bytes read + backtracks):\n";
+            std::snprintf(buf, sizeof buf, "%12s %8s %12s %12s %12s %10s  %s\n", "work", "bytes", "rules", "read", "backtracks", "memo", "input");
+            os << buf;
+            for ( const auto &r : worst )
+            {
+                std::snprintf(buf, sizeof buf, "%12llu %8zu %12llu %12llu %12llu %10llu  ", 
+                        r.work, r.input.length(), r.rules, r.bytes, r.backtracks, r.memo);
+                os << buf << quote(r.input, 40) << '\n';
+            }
+            if ( worst.empty() || worst[0].input.empty() )
+                return;
+
+            os << "worst input repeated:\n";
+            std::snprintf(buf, sizeof buf, "%8s %14s %12s %8s\n", "bytes", "work", "work/byte", "growth");
+            os << buf;
+
+            double prev_work = 0, factor = 0;
+            for ( std::size_t len = std::max<std::size_t>(worst[0].input.length() / 4, 1) ; len <= maxlen ; len *= 2 )
+            {
+                // Doubling the length multiplies work by about the last factor
+                if ( factor && prev_work * factor > budget )
+                    break;
+
+                result r = measure(pump(worst[0].input, len));
+                std::snprintf(buf, sizeof buf, "%8zu %14llu %12.1f ", len, r.work, double(r.work) / len);
+                os << buf;
+                if ( prev_work )
+                {
+                    factor = r.work / prev_work;
+                    std::snprintf(buf, sizeof buf, "%8.2f", std::log2(factor));
+                    os << buf;
+                }
+                os << '\n';
+                prev_work = r.work;
+            }
+        }
+    };
+#endif
+
+#ifdef PEG_TREE
+    // The syntax tree of a parse, if the parser builds trees (see build_tree()): a node
+    // for each rule with a name or label that succeeded, spanning the text it matched.
+    // Nodes are kept in preorder in one array, so walking a tree reads memory in order.
+    // Valid until the parse is accepted or the parser parses again.
+    class Tree
+    {
+        const details::matcher &m;
+
+    public:
+
+        // The siblings of a level, from one of them to the last
+        class Cursor
+        {
+            const details::matcher *m;
+            std::size_t i, last;
+
+            const details::matcher::tree_node &node() const { return m->nodes[i]; }
+
+        public:
+
+            Cursor(const details::matcher *m, std::size_t i, std::size_t last) : m(m), i(i), last(last) { }
+
+            explicit operator bool() const { return i < last; }     // false past the last sibling
+
+            const Rule &rule() const { return *node().rule; }
+            const char *kind() const { return rule().get_name() ? rule().get_name() : rule().get_label(); }
+            unsigned long long begin() const { return m->offset + node().begin; }    // input offsets
+            unsigned long long end() const { return m->offset + node().end; }
+            std::string_view text() const { return std::string_view(m->ibuf).substr(node().begin, node().end - node().begin); }
+            unsigned children() const { return node().children; }
+
+            Cursor child() const { return Cursor(m, i + 1, i + 1 + node().size); }     // the first child
+            Cursor &next() { i += node().size + 1; return *this; }                     // the next sibling
+        };
+
+        Tree(const details::matcher &m) : m(m) { }
+
+        std::size_t size() const { return m.nodes.size(); }
+        Cursor top() const { return Cursor(&m, 0, m.nodes.size()); }       // the first top-level node
+    };
+#endif
+
+    namespace details
+    {
+        class parser
+        {
+            Rule &__start;
+            std::unique_ptr<details::matcher::byte_set> __first;       // of the start rule, for scans
+            std::unique_ptr<details::matcher::literal_set> __heads;    // literals its matches start with, if known
+
+            // The parser running actions and predicates in this thread
+            static inline thread_local parser *__current = nullptr;
+
+            // Make a parser current while in scope
+            class binder
+            {
+                parser *saved;
+
+            public:
+
+                binder(parser *p) : saved(__current) { __current = p; }
+                ~binder() { __current = saved; }
+            };
+
+#ifdef PEG_TRACE
+            Tracer *__tracer = nullptr;
+            unsigned __trace_every = 1, __trace_count = 0;
+
+            // Parse, tracing every Nth round
+            bool traced_parse()
+            {
+                __m.tracer = __trace_count++ % __trace_every ? nullptr : __tracer;
+                if ( !__m.tracer )
+                    return __start.parse(__m);
+
+                __m.tracer->begin(__m.position());
+                bool r = __start.parse(__m);
+                __m.tracer->end(__m.position(), r);
+                __m.tracer = nullptr;
+                return r;
+            }
+#endif
+
+            bool parse_start()
+            {
+#ifdef PEG_TRACE
+                if ( __tracer )
+                    return traced_parse();
+#endif
+                return __start.parse(__m);
+            }
+
+#ifdef __linux__
+            // A stack of its own for parses
+            struct stack
+            {
+                std::unique_ptr<char[]> mem;
+                std::size_t size;
+                ucontext_t caller, callee;
+                bool result;
+                std::exception_ptr error;
+            };
+            std::unique_ptr<stack> __stack;
+
+            static void on_stack()
+            {
+                parser &p = *__current;
+                try
+                {
+                    p.__stack->result = p.parse_start();
+                }
+                catch ( ... )
+                {
+                    p.__stack->error = std::current_exception();
+                }
+            }
+
+            // Parse on the stack, returning to this one when done
+            bool stack_parse()
+            {
+                stack &st = *__stack;
+                getcontext(&st.callee);
+                st.callee.uc_stack.ss_sp = st.mem.get();
+                st.callee.uc_stack.ss_size = st.size;
+                st.callee.uc_link = &st.caller;
+                makecontext(&st.callee, on_stack, 0);
+                st.error = nullptr;
+                swapcontext(&st.caller, &st.callee);
+                if ( st.error )
+                    std::rethrow_exception(st.error);
+                return st.result;
+            }
+#endif
+
+        protected:
+
+            details::matcher __m;
+
+        public:
+
+            // Construct with starting rule and input stream
+            parser(Rule &r, std::istream &in = std::cin) : __start(r), __m(in) { }
+
+            // Parsing methods
+            bool parse() 
+            { 
+                binder b(this); 
+                __m.reserve(); 
+                __m.depth = 0;
+                __m.too_deep = false;
+#ifdef PEG_TREE
+                __m.nodes.clear();
+#endif
+#ifdef __linux__
+                bool r = __stack ? stack_parse() : parse_start();
+#else
+                bool r = parse_start();
+#endif
+                return r && !__m.too_deep;
+            }
+            void accept() { binder b(this); __m.accept(); }
+            void clear() { __m.clear(); }
+
+#ifdef PEG_TREE
+            // Build a syntax tree of each parse (see Tree), or stop building them
+            void build_tree(bool on = true) { __m.tree = on; }
+            Tree tree() const { return Tree(__m); }
+#endif
+            std::string text() const { return __m.text(); }
+            std::string_view text_view() const { return __m.text_view(); }
+            unsigned long long text_position() const { return __m.offset + __m.cap_begin; }   // input offset of the captured text
+            unsigned long long round_position() const { return __m.offset; }                  // input offset of the round, all accepted before
+            std::string get_error() const { return __m.get_error(); } 
+
+            // How input bytes make the characters of Lit(char32_t), Ccl and Any (utf8 by 
+            // default). Grammars of bytes read bytes without decoding them.
+            void set_encoding(Encoding e) 
+            { 
+                __m.enc = e; 
+                __first.reset();        // scans skip by the encoding
+                __heads.reset();
+            }
+
+            // Fail parses that nest rules deeper than max_depth, with an error, instead 
+            // of overflowing the stack. If stack_size is given, parses run on a stack of
+            // that many bytes of their own, allocated once, for deeper nesting than the 
+            // thread's stack allows (Linux only, ignored elsewhere).
+            void limit_depth(unsigned max_depth, std::size_t stack_size = 0)
+            {
+                __m.max_depth = max_depth;
+#ifdef __linux__
+                __stack.reset();
+                if ( stack_size )
+                {
+                    __stack = std::make_unique<stack>();
+                    __stack->mem.reset(new char[stack_size]);     // not zeroed, so only pages used take memory
+                    __stack->size = stack_size;
+                }
+#endif
+            }
+
+            // Find the matches of the start rule from left to right, accepting each one,
+            // and pass the input between them to f in pieces. Matches are only tried at 
+            // bytes they may start with, by the rule's first set, or where the literals 
+            // they start with occur, and must not be empty.
+            void scan(const std::function<void(std::string_view)> &f)
+            {
+                if ( !__first )
+                {
+                    Analysis an(__start, __m.enc);
+                    __first = std::make_unique<details::matcher::byte_set>(an.first(__start));
+                    if ( __first->only < 0 )
+                    {
+                        auto h = an.heads(__start);
+                        if ( !h.empty() )
+                            __heads = std::make_unique<details::matcher::literal_set>(h);
+                    }
+                }
+                while ( __heads ? __m.skip_until(*__heads, f) : __m.skip_until(*__first, f) )
+                    if ( parse() && __m.pos )
+                        accept();
+                    else
+                        __m.reject(f);
+            }
+
+            // Parse each input from first to last (strings or string views in memory) as
+            // all the input of a round of its own, and accept it if it matches. f, if 
+            // given, gets the index and result of each: after accepting it, or with the
+            // error still available from get_error(). Buffers are reused, so inputs do not
+            // allocate once they have grown. Input already read from the stream and not 
+            // accepted is kept for the next parse(). Returns the number of inputs that 
+            // matched.
+            template <typename It> 
+            std::size_t parse_batch(It first, It last, const std::function<void(std::size_t, bool)> &f = nullptr)
+            {
+                std::string rest;
+                if ( !__m.ibuf.empty() )
+                    rest.swap(__m.ibuf);
+                unsigned long long offset = __m.offset, lines = __m.prev_lines;
+                bool in_memory = __m.in_memory;
+
+                std::size_t n = 0, matched = 0;
+                for ( ; first != last ; ++first, n++ )
+                {
+                    __m.set_input(std::string_view(*first));
+                    bool r = parse();
+                    if ( r )
+                    {
+                        accept();
+                        matched++;
+                    }
+                    if ( f )
+                        f(n, r);
+                }
+
+                __m.clear();
+                if ( !rest.empty() )
+                    __m.ibuf.swap(rest);
+                __m.offset = offset;
+                __m.prev_lines = lines;
+                __m.in_memory = in_memory;
+                return matched;
+            }
+
+            // The parser currently parsing or accepting in this thread, if any
+            static parser &current() { return *__current; }
+            static parser *running() { return __current; }
+
+#ifdef PEG_HEATMAP
+            // Print the backtracking heatmap of the accepted statements
+            void heatmap_report(std::ostream &os = std::cerr) const { __m.heat.report(os); }
+#endif
+
+#ifdef PEG_TRACE
+            // Trace every Nth parse round with t, or stop tracing if t is null
+            void trace(Tracer *t, unsigned every = 1) 
+            { 
+                __tracer = t; 
+                __trace_every = every ? every : 1; 
+                __trace_count = 0; 
+            }
+#endif
+
+    #ifdef PEG_DEBUG
+            // Grammar check
+            void check() const { __start.check(); }
+    #endif
+
+            // Static grammar analysis
+            void analyze(std::ostream &os = std::cerr) const { Analysis(__start).report(os); }
+        };
+    }
+
+    // Parser 
+    template <typename T = void>
+    class Parser : public details::parser
+    {
+        details::value_stack<T> __values;
+
+        // Extra state for memoizing val(0)
+        struct memo_state_extra : details::matcher::memo_state
+        {
+            T val0;
+            Parser *p;
+
+            memo_state_extra(Parser *p) : p(p) { }
+
+            virtual void save_extra() { val0 = p->val(0); }
+            virtual void restore_extra() { p->val(0) = val0; }
+        };
+
+        // Memo state allocator
+        std::function<details::matcher::memo_state *()> alloc = [ this ] { return new memo_state_extra{this}; };
+
+    public:
+
+        // Construct with starting rule and input stream
+        Parser(Rule &r, std::istream &in = std::cin) : details::parser(r, in), __values(__m) { __m.use_vs(alloc); }
+        Parser(Rule &r, std::size_t capacity, std::istream &in = std::cin) : details::parser(r, in), __values(__m, capacity) { __m.use_vs(alloc); }
+
+        // Parse, scan or parse a batch, reserving the value stack on first use
+        bool parse() { __values.reserve(); return details::parser::parse(); }
+        void scan(const std::function<void(std::string_view)> &f) { __values.reserve(); details::parser::scan(f); }
+        template <typename It> 
+        std::size_t parse_batch(It first, It last, const std::function<void(std::size_t, bool)> &f = nullptr)
+        { 
+            __values.reserve(); 
+            return details::parser::parse_batch(first, last, f); 
+        }
+
+        // Reference to a value stack slot
+        T &val(std::size_t idx) { return __values[idx]; }
+        const T &val(std::size_t idx) const { return __values[idx]; }
+
+        // Reference to a value contained in a variant type value stack slot
+        template <typename U> U &val(std::size_t idx) { return std::get<U>(__values[idx]); }
+        template <typename U> const U &val(std::size_t idx) const { return std::get<U>(__values[idx]); }
+    };
+
+    template < >
+    class Parser <void> : public details::parser
+    {
+    public:
+
+        using details::parser::parser;
+    };
+
+    // Grammar 
+    // A grammar holds rules that can be shared by any number of parsers, so that they are 
+    // built only once. Actions and predicates reach the parser that is running them
+    // through context(), which must be a C.
+    template <typename T = void, typename C = Parser<T>>
+    class Grammar
+    {
+    protected:
+
+        // The running parser and its captured text
+        static C &context() { return static_cast<C &>(details::parser::current()); }
+        static std::string text() { return context().text(); }
+        static std::string_view text_view() { return context().text_view(); }
+
+        // Reference to a value stack slot of the running parser
+        static T &val(std::size_t idx) { return context().val(idx); }
+
+        // Reference to a value contained in a variant type value stack slot
+        template <typename U> static U &val(std::size_t idx) { return context().template val<U>(idx); }
+    };
+
+    template <typename C>
+    class Grammar <void, C>
+    {
+    protected:
+
+        static C &context() { return static_cast<C &>(details::parser::current()); }
+        static std::string text() { return context().text(); }
+        static std::string_view text_view() { return context().text_view(); }
+    };
+
+    // Token pipeline
+    // A TokenStream splits input into tokens with a lexical grammar, on a thread of its
+    // own if asked to, and serves their kinds, one char per token, as the input of a 
+    // parser of tokens. Its grammar matches kinds with Lit, Ccl and Any, so input is
+    // lexed once however much the parser backtracks, and its actions get the text of
+    // the tokens they captured from the stream. Kinds are ASCII chars, or any bytes for
+    // parsers reading bytes (see Encoding). Tokens are kept until the parser accepts them.
+    struct Token
+    {
+        char kind;
+        unsigned long long begin, end;      // input offsets of its text
+        unsigned text;                      // of its text in its block
+    };
+
+    class TokenStream : public std::streambuf
+    {
+        static const unsigned BLOCK = 4096;         // tokens served at once
+        static const unsigned QUEUED = 16;          // blocks lexed ahead by the thread
+        static const unsigned ROUND = 64;           // tokens lexed by a parse round
+
+        struct block
+        {
+            std::string kinds;
+            std::vector<Token> tokens;
+            std::string text;
+        };
+
+        Rule start;
+        Parser<> lex;                               // of the lexical grammar, whose token actions add to cur
+        bool end = false;                           // input ended
+        std::string error;
+        std::unique_ptr<block> cur;                 // being lexed
+
+        std::deque<std::unique_ptr<block>> blocks;  // served and not yet accepted
+        unsigned long long first = 0;               // number of blocks[0]
+
+        // Lexing thread and the blocks it has ready
+        std::thread worker;
+        mutable std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<std::unique_ptr<block>> ready;
+        bool stop = false, finished = false;
+
+        void fail(const std::string &e)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            error = e;
+        }
+
+        // The stream whose lexer runs on this thread, for token actions
+        static inline thread_local TokenStream *lexing = nullptr;
+
+        class lexing_scope
+        {
+            TokenStream *saved;
+
+        public:
+
+            lexing_scope(TokenStream *ts) : saved(lexing) { lexing = ts; }
+            ~lexing_scope() { lexing = saved; }
+        };
+
+        void add(char kind)
+        {
+            std::string_view t = lex.text_view();
+            unsigned long long b = lex.text_position();
+            cur->kinds += kind;
+            cur->tokens.push_back({ kind, b, b + t.length(), unsigned(cur->text.length()) });
+            cur->text += t;
+        }
+
+        // Lex a block of tokens, the last one maybe shorter. Null if none are left.
+        std::unique_ptr<block> produce()
+        {
+            lexing_scope ls(this);
+            cur = std::make_unique<block>();
+            cur->tokens.reserve(BLOCK);
+            while ( !end && cur->tokens.size() < BLOCK )
+                if ( lex.parse() )
+                    lex.accept();
+                else
+                {
+                    fail(lex.get_error());
+                    end = true;
+                }
+            if ( cur->tokens.empty() )
+                cur.reset();
+            return std::move(cur);
+        }
+
+        void run()
+        {
+            for ( ;; )
+            {
+                std::unique_ptr<block> b;
+                try
+                {
+                    b = produce();
+                }
+                catch ( std::exception &e )
+                {
+                    fail(e.what());
+                }
+
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this] { return stop || ready.size() < QUEUED; });
+                if ( stop )
+                    return;
+                if ( !b )
+                {
+                    finished = true;
+                    cv.notify_all();
+                    return;
+                }
+                ready.push_back(std::move(b));
+                cv.notify_all();
+            }
+        }
+
+        std::unique_ptr<block> take()
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return !ready.empty() || finished; });
+            if ( ready.empty() )
+                return nullptr;
+            std::unique_ptr<block> b = std::move(ready.front());
+            ready.pop_front();
+            cv.notify_all();
+            return b;
+        }
+
+    protected:
+
+        // Serve the kinds of the next block, freeing the blocks whose tokens the parser
+        // reading them has accepted
+        int_type underflow()
+        {
+            if ( details::parser *p = details::parser::running() )
+                for ( unsigned long long accepted = p->round_position() / BLOCK ; first < accepted && !blocks.empty() ; first++ )
+                    blocks.pop_front();
+
+            std::unique_ptr<block> b = worker.joinable() ? take() : produce();
+            if ( !b )
+                return traits_type::eof();
+            blocks.push_back(std::move(b));
+            std::string &k = blocks.back()->kinds;
+            setg(k.data(), k.data(), k.data() + k.length());
+            return traits_type::to_int_type(k[0]);
+        }
+
+    public:
+
+        // Tokens are matched by rule tokens after skipping what rule skip matches, and
+        // must not be empty. With threaded, input is lexed by a thread ahead of the parser.
+        TokenStream(Rule &tokens, Rule &skip, std::istream &in = std::cin, bool threaded = false) : lex(start, in)
+        {
+            start = skip >> ( (tokens >> skip)[{ 1, ROUND }] | !Any() >> Do([this] { end = true; }) );
+            if ( threaded )
+                worker = std::thread([this] { run(); });
+        }
+
+        ~TokenStream()
+        {
+            if ( worker.joinable() )
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    stop = true;
+                }
+                cv.notify_all();
+                worker.join();
+            }
+        }
+
+        // Add a token of kind with the text captured by the running lexical action
+        static void emit(char kind)
+        {
+            if ( !lexing )
+                throw std::logic_error("Tok() used outside the lexical grammar of a TokenStream");
+            lexing->add(kind);
+        }
+
+        // Token i of input, once served to the parser and until it is accepted
+        const Token &token(unsigned long long i) const { return blocks[i / BLOCK - first]->tokens[i % BLOCK]; }
+        std::string_view token_text(unsigned long long i) const 
+        { 
+            const block &b = *blocks[i / BLOCK - first];
+            const Token &t = b.tokens[i % BLOCK];
+            return std::string_view(b.text).substr(t.text, t.end - t.begin); 
+        }
+
+        // The kth token captured by the parser running an action, and its text
+        const Token &captured(std::size_t k = 0) const { return token(details::parser::current().text_position() + k); }
+        std::string_view text(std::size_t k = 0) const { return token_text(details::parser::current().text_position() + k); }
+
+        // Why lexing stopped before the end of input, empty if it did not or has not 
+        // stopped yet
+        std::string get_error() const 
+        { 
+            std::lock_guard<std::mutex> lock(mtx);
+            return finished || !worker.joinable() ? error : "";
+        }
+    };
+
+    // A token of kind, matched by e. Only for the rules of a TokenStream's lexical 
+    // grammar: its actions throw std::logic_error when run by other parsers.
+    inline Expr Tok(char kind, const Expr &e) { return --e >> Do([kind] { TokenStream::emit(kind); }); }
+
+#ifdef PEG_PROFILE
+    // Rule profiler, enabled by defining PEG_PROFILE (and PEG_PROFILE_PERF for hardware counters).
+    // Rules are reported by the names given with peg_debug(), or by their labels.
+    class Profiler
+    {
+        static void exit_report() { report(); }
+
+    public:
+
+        static void report(std::ostream &os = std::cerr) { details::profiler::get().report(os); }
+        static void report_at_exit() 
+        { 
+            details::profiler::get();       // so that it is destroyed after reporting
+            std::atexit(exit_report); 
+        }
+        static void reset() { details::profiler::get().reset(); }
+    };
+#endif
+
+} // namespace peg
+
+// Set a rule's name for debugging and profiling
+#define peg_debug(rule)     rule.set_name(#rule)
 
 // Semantic actions and predicates
 #define do_(...)            (peg::Do([&]{ __VA_ARGS__ }))  
@@ -0,0 +1,80 @@
+/*
+The integer calculator of intcalc.cc, parsing tokens produced by a lexical grammar
+*/
+
+#include <iostream>
+#include <string>
+
+#include "peg.h"
+
+using namespace std;
+using namespace peg;
+
+// Token kinds: numbers are 'n', operators and parentheses are themselves
+class lexer
+{
+public:
+
+    Rule WS, NUMBER, tokens{"token"};
+
+    lexer()
+    {
+        WS          = *" \t\f\r\n"_ccl;
+        NUMBER      = +"0-9"_ccl;
+        tokens      = Tok('n', NUMBER)
+                    | Tok('+', "+"_lit)
+                    | Tok('-', "-"_lit)
+                    | Tok('*', "*"_lit)
+                    | Tok('/', "/"_lit)
+                    | Tok('(', "("_lit)
+                    | Tok(')', ")"_lit)
+                    ;
+    }
+};
+
+class intcalc : public Parser<int>
+{
+    TokenStream &ts;
+    Rule calc, expression, term, factor;
+
+public:
+
+    intcalc(TokenStream &t, istream &in) : Parser(calc, in), ts(t)
+    {
+        limit_depth(10000);
+        set_encoding(Encoding::BYTES);      // token kinds are bytes
+
+        calc        = expression                    do_( cout << val(0) << endl; )
+                    ;
+        expression  = term >> *(
+                          '+'_lit >> term           do_( val(0) += val(2); )
+                        | '-'_lit >> term           do_( val(0) -= val(2); )
+                        )
+                    ;
+        term        = factor >> *(
+                          '*'_lit >> factor         do_( val(0) *= val(2); )
+                        | '/'_lit >> factor         do_( val(0) /= val(2); )
+                        )
+                    ;
+        factor      = 'n'_lit--                     do_( val(0) = stoi(string(ts.text())); )
+                    | '('_lit >> expression >> ')'_lit  do_( val(0) = val(1); )
+                    | '-'_lit >> factor             do_( val(0) = -val(1); )
+                    | '+'_lit >> factor             do_( val(0) = val(1); )
+                    ;
+    }
+};
+
+// Lexes input on a thread if some argument is given in the command line
+int main(int argc, char *argv[])
+{
+    lexer lex;
+    TokenStream ts(lex.tokens, lex.WS, cin, argc > 1);
+    istream in(&ts);
+    intcalc calc(ts, in);
+
+    while ( calc.parse() )
+        calc.accept();
+
+    if ( !ts.get_error().empty() )
+        cerr << ts.get_error() << endl;
+}
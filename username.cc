@@ -35,9 +35,8 @@ int main()
     Parser p(start);
 
     start   = "username"_lit        do_( cout << getlogin(); )
-            | Any()--               do_( cout << p.text(); )
             ;
 
-    while ( p.parse() )
-        p.accept();
+    // Copy the text between matches
+    p.scan([ ](string_view s) { cout << s; });
 }
@@ -1,35 +1,187 @@
 // A floating point calculator supporting exponentiation and named variables.
+// Statements are compiled to postfix code over variable slots, which runs over
+// columns of values: a single row, or the rows of a table given in a CSV file.
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
 #include <map>
+#include <algorithm>
 
 #include <math.h>
 
-//#define PEG_DEBUG            // Uncomment for checking the grammar
+//#define PEG_DEBUG            // Uncomment for checking and analyzing the grammar
+//#define PEG_PROFILE          // Uncomment for profiling the grammar
+//#define PEG_TRACE            // Uncomment for writing a flame graph of each statement to stderr
 
 #include "peg.h"
 
 using namespace std;
 using namespace peg;
 
-class calculator : public Parser<variant<double, string>>
+// A compiled statement
+struct program
 {
-    map<string, double> var;
+    enum opcode { CONST, LOAD, STORE, NEG, ADD, SUB, MUL, DIV, POW };
+
+    struct instr
+    {
+        opcode op;
+        unsigned arg;               // constant or variable slot
+    };
+
+    vector<instr> code;
+    vector<double> consts;
+    unsigned depth = 0, maxdepth = 0;
+    bool print = false;
+
+    void clear()
+    {
+        code.clear();
+        consts.clear();
+        depth = maxdepth = 0;
+        print = false;
+    }
+};
+
+class calculator : public Parser<string>
+{
+    struct grammar;
+
+    static const size_t BLOCK = 256;    // rows evaluated at a time
+
+    map<string, unsigned> slots;
+    vector<vector<double>> columns;     // variable values by slot, one per row
+    size_t rows = 1;
     unsigned line = 1;
 
+    program prog;                       // the statement being compiled
+    vector<double> stack;
+
+    void emit(program::opcode op, unsigned arg = 0)
+    {
+        prog.code.push_back({ op, arg });
+        if ( op == program::CONST || op == program::LOAD )
+            prog.maxdepth = max(prog.maxdepth, ++prog.depth);
+        else if ( op != program::STORE && op != program::NEG )
+            prog.depth--;
+    }
+
+    unsigned slot(const string &name)
+    {
+        auto i = slots.find(name);
+        if ( i != slots.end() )
+            return i->second;
+        columns.emplace_back(rows, 0.0);
+        return slots[name] = columns.size() - 1;
+    }
+
+    void constant(double d)
+    {
+        emit(program::CONST, prog.consts.size());
+        prog.consts.push_back(d);
+    }
+
+    void load(const string &name)
+    {
+        if ( !slots.count(name) )
+            cerr << "line " << line << ": defining " << name << " = 0\n";
+        emit(program::LOAD, slot(name));
+    }
+
+    void store(const string &name) { emit(program::STORE, slot(name)); }
+
+    void run();
+
+public:
+
+    calculator(istream &in = cin);
+
+    // Bind a variable to a column of values, one per row. All columns have as many 
+    // rows.
+    void bind(const string &name, vector<double> values);
+};
+
+// Run the compiled statement on blocks of rows. Each instruction is a loop over a block,
+// which the compiler can vectorize.
+void calculator::run()
+{
+    stack.resize(prog.maxdepth * BLOCK);
+    for ( size_t b = 0 ; b < rows && !prog.code.empty() ; b += BLOCK )
+    {
+        size_t n = min(BLOCK, rows - b);
+        double *sp = stack.data();      // next free block
+
+        auto binary = [&](auto f)
+        {
+            sp -= BLOCK;
+            double *x = sp - BLOCK, *y = sp;
+            for ( size_t i = 0 ; i < n ; i++ )
+                x[i] = f(x[i], y[i]);
+        };
+
+        for ( auto [op, arg] : prog.code )
+            switch ( op )
+            {
+                case program::CONST:
+                    fill(sp, sp + n, prog.consts[arg]);
+                    sp += BLOCK;
+                    break;
+                case program::LOAD:
+                    copy(columns[arg].begin() + b, columns[arg].begin() + b + n, sp);
+                    sp += BLOCK;
+                    break;
+                case program::STORE:
+                    copy(sp - BLOCK, sp - BLOCK + n, columns[arg].begin() + b);
+                    break;
+                case program::NEG:
+                    for ( size_t i = 0 ; i < n ; i++ )
+                        sp[i - BLOCK] = -sp[i - BLOCK];
+                    break;
+                case program::ADD:  binary([](double x, double y) { return x + y; });    break;
+                case program::SUB:  binary([](double x, double y) { return x - y; });    break;
+                case program::MUL:  binary([](double x, double y) { return x * y; });    break;
+                case program::DIV:  binary([](double x, double y) { return x / y; });    break;
+                case program::POW:  binary([](double x, double y) { return pow(x, y); }); break;
+            }
+
+        if ( prog.print )
+            for ( size_t i = 0 ; i < n ; i++ )
+                cout << stack[i] << '\n';
+    }
+    if ( prog.print )
+        cout.flush();
+    prog.clear();
+}
+
+void calculator::bind(const string &name, vector<double> values)
+{
+    if ( slots.empty() )
+        rows = values.size();
+    columns[slot(name)] = move(values);
+}
+
+// The calculator grammar, built once and shared by all calculators
+struct calculator::grammar : Grammar<string, calculator>
+{
     Rule SPACE, EOL, ALPHA, ALNUM, SIGN, DIGIT, DOT, UDEC, EXP, COMM;     
     Rule WS, LPAR, RPAR, ADD, SUB, MUL, DIV, POW, EQUALS, ENDL, PRINT, IDENT, NUMBER;
     Rule calc, error, statement, expression, term, factor, atom;
 
-public:
+    static grammar &get() 
+    { 
+        static grammar g;
+        return g;
+    }
 
-    calculator(istream &in = cin) : Parser(calc, in)
+    grammar()
     {
         // Basic lexical definitions 
 
         SPACE       = " \t\f"_ccl;
-        EOL         = ("\r\n" | "\r\n"_ccl)                 do_( ++line; );
+        EOL         = ("\r\n" | "\r\n"_ccl)                 do_( ++context().line; );
         ALPHA       = "_a-zA-Z"_ccl;
         ALNUM       = "_a-zA-Z0-9"_ccl;
         SIGN        = "+-"_ccl;
@@ -53,56 +205,55 @@ public:
         ENDL        = (~COMM >> EOL | ';') >> WS;
         PRINT       = "print" >> !ALNUM  >> WS;
         IDENT       = !PRINT >> (ALPHA >> *ALNUM)-- >> WS   do_( val(0) = text(); );
-        NUMBER      = (UDEC >> ~EXP)-- >> WS                do_( val(0) = stod(text()); );
+        NUMBER      = (UDEC >> ~EXP)-- >> WS                do_( context().constant(stod(text())); );
 
         // Calculator grammar
 
-        calc        = WS >> ~statement >> ENDL
+        calc        = WS >> ~statement >> ENDL              do_( context().run(); )
                     | WS >> error >> ENDL
                     ;    
 
-        error       = (+(!ENDL >> Any()))--                 do_( cerr << "line " << line << ": ERROR: " << text() << endl; )
+        error       = (+(!ENDL >> Any()))--                 do_( cerr << "line " << context().line << ": ERROR: " << text() << endl; )
                     ;
 
-        statement   = PRINT >> expression                   do_( cout << val<double>(1) << endl; )
+        statement   = PRINT >> expression                   do_( context().prog.print = true; )
                     | expression    
                     ;
 
-        expression  = IDENT >> EQUALS >> expression         do_( var[val<string>(0)] = val<double>(2); val(0) = val(2); )
+        // Actions run in postfix order, emitting code
+
+        expression  = IDENT >> EQUALS >> expression         do_( context().store(val(0)); )
                     | term >> *(    
-                          ADD >> term                       do_( val<double>(0) += val<double>(2); )
-                        | SUB >> term                       do_( val<double>(0) -= val<double>(2); )
+                          ADD >> term                       do_( context().emit(program::ADD); )
+                        | SUB >> term                       do_( context().emit(program::SUB); )
                         )
                     ;
 
         term        = factor >> *(
-                          MUL >> factor                     do_( val<double>(0) *= val<double>(2); )    
-                        | DIV >> factor                     do_( val<double>(0) /= val<double>(2); )
+                          MUL >> factor                     do_( context().emit(program::MUL); )    
+                        | DIV >> factor                     do_( context().emit(program::DIV); )
                         )
                     ;
 
-        factor      = ADD >> factor                         do_( val(0) = val(1); )                   // unary plus
-                    | SUB >> factor                         do_( val(0) = -val<double>(1); )          // unary minus
+        factor      = ADD >> factor                                                                   // unary plus
+                    | SUB >> factor                         do_( context().emit(program::NEG); )      // unary minus
                     | atom >> *(
-                          POW >> atom                       do_( val(0) = pow(val<double>(0), val<double>(2)); )
+                          POW >> atom                       do_( context().emit(program::POW); )
                         )
                     ;
 
-        atom        = ADD >> atom                           do_( val(0) = val(1); )                   // unary plus
-                    | SUB >> atom                           do_( val(0) = -val<double>(1); )          // unary minus
+        atom        = ADD >> atom                                                                     // unary plus
+                    | SUB >> atom                           do_( context().emit(program::NEG); )      // unary minus
                     | NUMBER 
-                    | IDENT                                 do_
-                                                            (
-                                                                if ( !var.count(val<string>(0)) )
-                                                                    cerr << "line " << line << ": defining " << val<string>(0) << " = 0\n";
-                                                                val(0) = var[val<string>(0)]; 
-                                                            )
-                    | LPAR >> expression >> RPAR            do_( val(0) = val(1); )
+                    | IDENT                                 do_( context().load(val(0)); )
+                    | LPAR >> expression >> RPAR
                     ;
 
-#ifdef PEG_DEBUG
+#if defined(PEG_DEBUG) || defined(PEG_PROFILE) || defined(PEG_TRACE)
 
-        // Rules to be debugged while checking
+        // Rules to be debugged while checking, profiled or traced
+        peg_debug(WS);
+        peg_debug(ENDL);
         peg_debug(PRINT);
         peg_debug(IDENT);
         peg_debug(EQUALS);
@@ -122,20 +273,81 @@ public:
         peg_debug(factor);
         peg_debug(atom);
 
-        // Check the grammar    
-        check();
+#endif
+
+        // Numbers, comments and white space run as DFAs
+        Compile(calc);
+
+#ifdef PEG_DEBUG
+
+        // Check and analyze the grammar    
+        calc.check();
+        Analysis(calc).report();
+
+#endif
+
+#ifdef PEG_PROFILE
+
+        // Print the profile at exit
+        Profiler::report_at_exit();
 
 #endif
         
     }
 };
 
-int main()
+calculator::calculator(istream &in) : Parser(grammar::get().calc, in) { }
+
+// Read a table: variable names in the first line, then rows of values, separated 
+// by commas
+static bool read_table(const char *file, calculator &c)
+{
+    ifstream in(file);
+    string line, cell;
+    vector<string> names;
+    vector<vector<double>> values;
+
+    if ( !getline(in, line) )
+        return false;
+    for ( istringstream ss(line) ; ss >> ws && getline(ss, cell, ',') ; )
+        names.push_back(cell.erase(cell.find_last_not_of(" \t\r") + 1));
+    values.resize(names.size());
+
+    while ( getline(in, line) )
+    {
+        size_t i = 0;
+        for ( istringstream ss(line) ; getline(ss, cell, ',') && i < names.size() ; i++ )
+            values[i].push_back(strtod(cell.c_str(), nullptr));
+        if ( i != names.size() )
+            return false;
+    }
+
+    for ( size_t i = 0 ; i < names.size() ; i++ )
+        c.bind(names[i], move(values[i]));
+    return true;
+}
+
+int main(int argc, char *argv[])
 {
     calculator c;
 
+    if ( argc > 1 && !read_table(argv[1], c) )
+    {
+        cerr << "Invalid table " << argv[1] << endl;
+        return 1;
+    }
+
+#ifdef PEG_TRACE
+    FoldedTracer tracer;
+    c.trace(&tracer);
+#endif
+
     // Parse and execute
     while ( c.parse() ) 
         c.accept();
+
+#ifdef PEG_TRACE
+    tracer.write(cerr);
+#endif
 }
 